@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include "alloc_tracker.h"
+
+// Every block carries its size and category in front so free() can
+// account for it. 16 bytes keeps the user pointer aligned for any type.
+static constexpr size_t header_size = 16;
+struct BlockHeader {
+    size_t size;
+    AllocCategory category;
+};
+static_assert(sizeof(BlockHeader) <= header_size);
+
+static const char *category_names[alloc_category_count] = {"other", "document", "text", "raster"};
+
+struct CategoryCounters {
+    std::atomic<long long> live{0};
+    std::atomic<long long> peak{0};
+    std::atomic<unsigned long long> allocs{0};
+};
+static CategoryCounters categories[alloc_category_count];
+static std::atomic<long long> live{0};
+static std::atomic<long long> peak{0};
+static thread_local long long thread_net = 0;
+static thread_local AllocCategory thread_category = AllocCategory::other;
+// Allocation rates in dump() are over the time since the previous dump
+static std::chrono::steady_clock::time_point last_dump = std::chrono::steady_clock::now();
+
+static void raise_peak(std::atomic<long long> &peak_value, const long long now) {
+    long long seen = peak_value.load(std::memory_order_relaxed);
+    while (now > seen && !peak_value.compare_exchange_weak(seen, now, std::memory_order_relaxed)) {}
+}
+
+static void account(const AllocCategory category, const long long delta, const bool is_alloc) {
+    CategoryCounters &counters = categories[static_cast<int>(category)];
+    thread_net += delta;
+    raise_peak(counters.peak, counters.live.fetch_add(delta, std::memory_order_relaxed) + delta);
+    raise_peak(peak, live.fetch_add(delta, std::memory_order_relaxed) + delta);
+    if (is_alloc) counters.allocs.fetch_add(1, std::memory_order_relaxed);
+}
+
+const fz_alloc_context *AllocTracker::get() {
+    static const fz_alloc_context context = {nullptr, alloc, realloc, free};
+    return &context;
+}
+
+size_t AllocTracker::live_bytes() {
+    return static_cast<size_t>(std::max(0LL, live.load(std::memory_order_relaxed)));
+}
+
+size_t AllocTracker::peak_bytes() {
+    return static_cast<size_t>(std::max(0LL, peak.load(std::memory_order_relaxed)));
+}
+
+long long AllocTracker::thread_net_bytes() {
+    return thread_net;
+}
+
+void AllocTracker::dump(std::ostream &out) {
+    using Clock = std::chrono::steady_clock;
+    static std::mutex dump_mutex;
+    static unsigned long long last_allocs[alloc_category_count] = {};
+
+    std::lock_guard lock(dump_mutex);
+    const Clock::time_point now = Clock::now();
+    const double seconds = std::max(1e-3, std::chrono::duration<double>(now - last_dump).count());
+    last_dump = now;
+
+    out << "category     live_kb     peak_kb   allocs/s\n";
+    for (int c = 0; c < alloc_category_count; c++) {
+        const unsigned long long allocs = categories[c].allocs.load(std::memory_order_relaxed);
+        char line[96];
+        std::snprintf(line, sizeof line, "%-9s %10lld %11lld %10.0f\n", category_names[c],
+                      categories[c].live.load(std::memory_order_relaxed) / 1024,
+                      categories[c].peak.load(std::memory_order_relaxed) / 1024,
+                      static_cast<double>(allocs - last_allocs[c]) / seconds);
+        out << line;
+        last_allocs[c] = allocs;
+    }
+    out << "total live " << live_bytes() / 1024 << " KB, peak " << peak_bytes() / 1024 << " KB" << std::endl;
+}
+
+void *AllocTracker::alloc(void *, const size_t size) {
+    auto *block = static_cast<unsigned char *>(std::malloc(size + header_size));
+    if (!block) return nullptr;
+    auto *header = reinterpret_cast<BlockHeader *>(block);
+    header->size = size;
+    header->category = thread_category;
+    account(header->category, static_cast<long long>(size), true);
+    return block + header_size;
+}
+
+void *AllocTracker::realloc(void *, void *old, const size_t size) {
+    if (!old) return alloc(nullptr, size);
+    auto *block = static_cast<unsigned char *>(old) - header_size;
+    const size_t old_size = reinterpret_cast<BlockHeader *>(block)->size;
+    auto *grown = static_cast<unsigned char *>(std::realloc(block, size + header_size));
+    if (!grown) return nullptr;
+    auto *header = reinterpret_cast<BlockHeader *>(grown);
+    header->size = size;
+    account(header->category, static_cast<long long>(size) - static_cast<long long>(old_size), false);
+    return grown + header_size;
+}
+
+void AllocTracker::free(void *, void *ptr) {
+    if (!ptr) return;
+    auto *block = static_cast<unsigned char *>(ptr) - header_size;
+    const auto *header = reinterpret_cast<BlockHeader *>(block);
+    account(header->category, -static_cast<long long>(header->size), false);
+    std::free(block);
+}
+
+AllocScope::AllocScope(const AllocCategory category) : previous(thread_category) {
+    thread_category = category;
+}
+
+AllocScope::~AllocScope() {
+    thread_category = previous;
+}
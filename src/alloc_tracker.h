@@ -0,0 +1,49 @@
+#ifndef PDFF_ALLOC_TRACKER_H
+#define PDFF_ALLOC_TRACKER_H
+#include <cstddef>
+#include <ostream>
+
+extern "C" {
+    #include <mupdf/fitz.h>
+}
+
+// What an allocation was made for, set per thread with AllocScope
+enum class AllocCategory : unsigned char { other, document, text, raster };
+static constexpr int alloc_category_count = 4;
+
+// fz_alloc_context that keeps exact byte counts of everything MuPDF
+// allocates, in total and per category. The per-thread figure lets callers
+// measure what a piece of work on the current thread left behind, e.g. how
+// big a recorded display list is.
+//
+// Blocks come straight from malloc: MuPDF holds FZ_LOCK_ALLOC around every
+// call, so pooling per thread would not take any contention away.
+class AllocTracker {
+    public:
+        static const fz_alloc_context *get();
+
+        static size_t live_bytes();
+        static size_t peak_bytes();
+        // Bytes allocated minus bytes freed by the calling thread
+        static long long thread_net_bytes();
+        // Live/peak bytes and allocation rate per category since the last dump
+        static void dump(std::ostream &out);
+    private:
+        static void *alloc(void *user, size_t size);
+        static void *realloc(void *user, void *old, size_t size);
+        static void free(void *user, void *ptr);
+};
+
+// Attributes allocations on this thread to `category` while in scope
+class AllocScope {
+    public:
+        explicit AllocScope(AllocCategory category);
+        ~AllocScope();
+        AllocScope(const AllocScope &) = delete;
+        AllocScope &operator=(const AllocScope &) = delete;
+    private:
+        AllocCategory previous;
+};
+
+
+#endif //PDFF_ALLOC_TRACKER_H
@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "alloc_tracker.h"
+#include "batch_render.h"
+#include "doc_cache.h"
+#include "render_pool.h"
+
+// Each worker holds on to the list of the page it is drawing; nothing is
+// worth keeping once a page is written
+static constexpr size_t batch_list_budget = 0;
+
+static bool ends_with(const std::string &s, const char *suffix) {
+    const std::string tail(suffix);
+    if (s.size() < tail.size()) return false;
+    return std::equal(tail.rbegin(), tail.rend(), s.rbegin(), [](const char a, const char b) {
+        return a == std::tolower(static_cast<unsigned char>(b));
+    });
+}
+
+BatchRenderer::BatchRenderer(BatchOptions options) : options(std::move(options)) {
+    ctx = fz_new_context(AllocTracker::get(), locks.get(), this->options.store_bytes);
+    as_pnm = ends_with(this->options.output, ".pnm") || ends_with(this->options.output, ".ppm")
+          || ends_with(this->options.output, ".pgm");
+}
+
+BatchRenderer::~BatchRenderer() {
+    pages.reset();
+    if (ctx) {
+        fz_drop_document(ctx, doc);
+        fz_drop_context(ctx);
+    }
+}
+
+int BatchRenderer::run() {
+    if (!ctx) {
+        std::cerr << "Cannot create MuPDF context" << std::endl;
+        return 1;
+    }
+
+    int page_count = 0;
+    const std::unique_ptr<DocCache> cache = options.use_cache ? std::make_unique<DocCache>(options.input) : nullptr;
+    fz_try(ctx) {
+        fz_register_document_handlers(ctx);
+        // Pages are visited in order, so let the kernel read ahead
+        if (cache) {
+            doc = cache->open_document(ctx, options.mapped, MappedStream::Access::sequential);
+        } else {
+            doc = MappedStream::open_document(ctx, options.input, options.mapped,
+                                              MappedStream::Access::sequential, nullptr);
+        }
+        page_count = fz_count_pages(ctx, doc);
+    }
+    fz_catch(ctx) {
+        std::cerr << "Cannot open " << options.input << ": " << fz_caught_message(ctx) << std::endl;
+        return 1;
+    }
+
+    const int first = std::max(options.first_page, 1);
+    const int last = options.last_page > 0 ? std::min(options.last_page, page_count) : page_count;
+    if (first > last) {
+        std::cerr << "No pages in range " << first << "-" << last << std::endl;
+        return 1;
+    }
+    next_page = first - 1;
+    end_page = last;
+    pages = std::make_unique<PageCache>(ctx, doc, doc_mutex, batch_list_budget);
+
+    const unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+    const unsigned int wanted = std::min(options.threads ? options.threads : cores,
+                                         static_cast<unsigned int>(last - first + 1));
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0; i < wanted; i++) {
+        // Clone on this thread: fz_clone_context needs the parent to be idle
+        fz_context *worker_ctx = fz_clone_context(ctx);
+        if (!worker_ctx) break;
+        workers.emplace_back(&BatchRenderer::worker_main, this, worker_ctx);
+    }
+    if (workers.empty()) {
+        std::cerr << "Cannot clone MuPDF context" << std::endl;
+        return 1;
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const int rendered = last - first + 1 - failed;
+    std::cout << "Rendered " << rendered << " pages in " << seconds << " s ("
+              << (seconds > 0.0 ? rendered / seconds : 0.0) << " pages/s, "
+              << workers.size() << " threads)" << std::endl;
+    AllocTracker::dump(std::cerr);
+    return failed ? 1 : 0;
+}
+
+void BatchRenderer::worker_main(fz_context *worker_ctx) {
+    for (int page_num = next_page++; page_num < end_page; page_num = next_page++) {
+        if (!render_page(worker_ctx, page_num)) failed++;
+    }
+    fz_drop_context(worker_ctx);
+}
+
+bool BatchRenderer::render_page(fz_context *worker_ctx, const int page_num) {
+    fz_rect bounds = fz_empty_rect;
+    // Nothing aborts batch work; the cookie collects what MuPDF skipped over
+    fz_cookie cookie{};
+    fz_display_list *list = pages->get_list(worker_ctx, page_num, &bounds, &cookie);
+    if (!list) return false;
+    fz_pixmap *pix = RenderPool::rasterize(worker_ctx, list, bounds, options.dpi / 72.0f, fz_empty_irect, &cookie);
+    fz_drop_display_list(worker_ctx, list);
+    if (!pix) return false;
+    if (cookie.errors > 0) {
+        std::cerr << "Page " << page_num + 1 << ": " << cookie.errors
+                  << " error(s) while drawing, some content may be missing" << std::endl;
+    }
+
+    bool saved = true;
+    fz_try(worker_ctx) {
+        char path[4096];
+        fz_format_output_path(worker_ctx, path, sizeof path, options.output.c_str(), page_num + 1);
+        if (as_pnm) {
+            fz_save_pixmap_as_pnm(worker_ctx, pix, path);
+        } else {
+            fz_save_pixmap_as_png(worker_ctx, pix, path);
+        }
+    }
+    fz_always(worker_ctx) {
+        fz_drop_pixmap(worker_ctx, pix);
+    }
+    fz_catch(worker_ctx) {
+        fz_report_error(worker_ctx);
+        saved = false;
+    }
+    return saved;
+}
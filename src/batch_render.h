@@ -0,0 +1,67 @@
+#ifndef PDFF_BATCH_RENDER_H
+#define PDFF_BATCH_RENDER_H
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+
+extern "C" {
+    #include <mupdf/fitz.h>
+}
+
+#include "mu_locks.h"
+#include "page_cache.h"
+
+struct BatchOptions {
+    std::string input;
+    // Output path; %d is replaced by the page number. Written as PNM when
+    // it ends in .pnm/.ppm/.pgm, PNG otherwise.
+    std::string output;
+    float dpi = 72.0f;
+    // 1-based and inclusive; last_page 0 means the last page of the document
+    int first_page = 1;
+    int last_page = 0;
+    // 0 = one worker per core
+    unsigned int threads = 0;
+    // Resource store cap, 0 = unlimited
+    size_t store_bytes = FZ_STORE_DEFAULT;
+    // Memory-map the input instead of reading it through MuPDF's file stream
+    bool mapped = true;
+    // Use and fill the document's cache directory, as the viewer does.
+    // Off by default, so batch runs leave nothing behind in ~/.cache.
+    bool use_cache = false;
+};
+
+// Headless rasterization of a page range to image files, for servers
+// without a display. Uses the same display-list path as the viewer: workers
+// take the document lock only to record a page, then draw and encode it on
+// their own cloned context in parallel.
+class BatchRenderer {
+    public:
+        explicit BatchRenderer(BatchOptions options);
+        ~BatchRenderer();
+        BatchRenderer(const BatchRenderer &) = delete;
+        BatchRenderer &operator=(const BatchRenderer &) = delete;
+
+        // Returns the process exit status
+        int run();
+    private:
+        BatchOptions options;
+        MuLocks locks;
+        fz_context *ctx = nullptr;
+        fz_document *doc = nullptr;
+        std::mutex doc_mutex;
+        std::unique_ptr<PageCache> pages;
+        bool as_pnm = false;
+
+        // 0-based pages still to claim, and how many of them failed
+        std::atomic<int> next_page{0};
+        int end_page = 0;
+        std::atomic<int> failed{0};
+
+        void worker_main(fz_context *worker_ctx);
+        bool render_page(fz_context *worker_ctx, int page_num);
+};
+
+
+#endif //PDFF_BATCH_RENDER_H
@@ -0,0 +1,279 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+#include "alloc_tracker.h"
+#include "bench.h"
+#include "mapped_stream.h"
+#include "render_pool.h"
+#include "texture_pool.h"
+
+using Clock = std::chrono::steady_clock;
+
+const char *Benchmark::stage_names[STAGE_COUNT] = {
+    "load", "stext", "list", "raster", "upload", "raster_native", "upload_native", "total"
+};
+
+static double ms_between(const Clock::time_point from, const Clock::time_point to) {
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+Benchmark::Benchmark(BenchOptions options) : options(std::move(options)) {
+    ctx = fz_new_context(AllocTracker::get(), locks.get(), FZ_STORE_DEFAULT);
+}
+
+Benchmark::~Benchmark() {
+    if (renderer) SDL_DestroyRenderer(renderer);
+    if (window) SDL_DestroyWindow(window);
+    if (window || renderer) SDL_Quit();
+    if (ctx) {
+        fz_drop_document(ctx, doc);
+        fz_drop_context(ctx);
+    }
+}
+
+int Benchmark::run() {
+    if (!ctx) {
+        std::cerr << "Cannot create MuPDF context" << std::endl;
+        return 1;
+    }
+
+    int page_count = 0;
+    fz_try(ctx) {
+        fz_register_document_handlers(ctx);
+        const Clock::time_point start = Clock::now();
+        doc = MappedStream::open_document(ctx, options.input, options.mapped, MappedStream::Access::random);
+        page_count = fz_count_pages(ctx, doc);
+        open_ms = ms_between(start, Clock::now());
+    }
+    fz_catch(ctx) {
+        std::cerr << "Cannot open " << options.input << ": " << fz_caught_message(ctx) << std::endl;
+        return 1;
+    }
+
+    // Without a display the upload column stays empty
+    if (SDL_Init(SDL_INIT_VIDEO) == 0) {
+        window = SDL_CreateWindow("PDFF Bench", 0, 0, 64, 64, SDL_WINDOW_HIDDEN);
+        if (window) renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+    }
+    if (!renderer) std::cerr << "No renderer, skipping upload timing: " << SDL_GetError() << std::endl;
+    if (renderer) {
+        native_format = TexturePool::preferred_format(renderer);
+        TexturePool::pixel_format(native_format, &native_layout);
+    }
+
+    std::vector<PageTimes> pages(page_count);
+    PageTimes all;
+    int failed = 0;
+    for (int p = 0; p < page_count; p++) {
+        if (!time_page(p, &pages[p])) {
+            failed++;
+            continue;
+        }
+        for (int s = 0; s < STAGE_COUNT; s++) {
+            all.ms[s].insert(all.ms[s].end(), pages[p].ms[s].begin(), pages[p].ms[s].end());
+        }
+    }
+
+    if (options.csv) {
+        print_csv(pages, all);
+    } else {
+        print_json(pages, all, failed);
+    }
+    return failed ? 1 : 0;
+}
+
+bool Benchmark::time_page(const int page_num, PageTimes *times) {
+    const float scale = options.dpi / 72.0f;
+    for (int rep = 0; rep < options.reps; rep++) {
+        // Every repetition decodes fonts and images again, like a first visit
+        fz_empty_store(ctx);
+
+        fz_page *page = nullptr;
+        fz_stext_page *stext = nullptr;
+        fz_display_list *list = nullptr;
+        fz_device *dev = nullptr;
+        fz_pixmap *pix = nullptr;
+        fz_pixmap *native = nullptr;
+        double ms[STAGE_COUNT] = {};
+        bool ok = true;
+
+        fz_var(page);
+        fz_var(stext);
+        fz_var(list);
+        fz_var(dev);
+        fz_var(pix);
+        fz_var(native);
+        fz_try(ctx) {
+            const Clock::time_point start = Clock::now();
+            page = fz_load_page(ctx, doc, page_num);
+            const fz_rect bounds = fz_bound_page(ctx, page);
+            const Clock::time_point loaded = Clock::now();
+
+            stext = fz_new_stext_page_from_page(ctx, page, nullptr);
+            const Clock::time_point text_done = Clock::now();
+
+            list = fz_new_display_list(ctx, bounds);
+            dev = fz_new_list_device(ctx, list);
+            fz_run_page(ctx, page, dev, fz_identity, nullptr);
+            fz_close_device(ctx, dev);
+            const Clock::time_point recorded = Clock::now();
+
+            // The viewer rasterizes from the list, so that is what is timed
+            pix = RenderPool::rasterize(ctx, list, bounds, scale, fz_empty_irect, nullptr);
+            if (!pix) fz_throw(ctx, FZ_ERROR_GENERIC, "rasterization failed");
+            const Clock::time_point drawn = Clock::now();
+
+            ms[LOAD] = ms_between(start, loaded);
+            ms[STEXT] = ms_between(loaded, text_done);
+            ms[LIST] = ms_between(text_done, recorded);
+            ms[RASTER] = ms_between(recorded, drawn);
+
+            if (renderer) {
+                ms[UPLOAD] = time_upload(pix, SDL_PIXELFORMAT_RGB24);
+                upload_bytes[0] += static_cast<double>(pix->stride) * pix->h;
+                upload_ms[0] += ms[UPLOAD];
+            }
+            ms[TOTAL] = ms_between(start, Clock::now());
+
+            // The same page drawn and uploaded the way the viewer does it
+            if (renderer) {
+                const Clock::time_point native_start = Clock::now();
+                native = RenderPool::rasterize(ctx, list, bounds, scale, fz_empty_irect, nullptr, 8, 0, nullptr,
+                                               native_layout);
+                if (!native) fz_throw(ctx, FZ_ERROR_GENERIC, "rasterization failed");
+                ms[RASTER_NATIVE] = ms_between(native_start, Clock::now());
+                ms[UPLOAD_NATIVE] = time_upload(native, native_format);
+                upload_bytes[1] += static_cast<double>(native->stride) * native->h;
+                upload_ms[1] += ms[UPLOAD_NATIVE];
+            }
+        }
+        fz_always(ctx) {
+            fz_drop_pixmap(ctx, native);
+            fz_drop_pixmap(ctx, pix);
+            fz_drop_device(ctx, dev);
+            fz_drop_display_list(ctx, list);
+            fz_drop_stext_page(ctx, stext);
+            fz_drop_page(ctx, page);
+        }
+        fz_catch(ctx) {
+            std::cerr << "Page " << page_num + 1 << ": " << fz_caught_message(ctx) << std::endl;
+            ok = false;
+        }
+        if (!ok) return false;
+
+        for (int s = 0; s < STAGE_COUNT; s++) {
+            const bool needs_renderer = s == UPLOAD || s == RASTER_NATIVE || s == UPLOAD_NATIVE;
+            if (!needs_renderer || renderer) times->ms[s].push_back(ms[s]);
+        }
+    }
+    return true;
+}
+
+double Benchmark::time_upload(const fz_pixmap *pix, const Uint32 format) {
+    const Clock::time_point start = Clock::now();
+    SDL_Texture *tex = SDL_CreateTexture(renderer, format, SDL_TEXTUREACCESS_STATIC, pix->w, pix->h);
+    SDL_UpdateTexture(tex, nullptr, pix->samples, static_cast<int>(pix->stride));
+    // Make sure the driver has actually taken the pixels
+    SDL_RenderCopy(renderer, tex, nullptr, nullptr);
+    SDL_RenderFlush(renderer);
+    SDL_DestroyTexture(tex);
+    return ms_between(start, Clock::now());
+}
+
+double Benchmark::upload_mb_per_s(const int path) const {
+    if (upload_ms[path] <= 0.0) return 0.0;
+    return upload_bytes[path] / (upload_ms[path] / 1000.0) / (1024.0 * 1024.0);
+}
+
+Benchmark::Stats Benchmark::stats(std::vector<double> samples) {
+    Stats result;
+    if (samples.empty()) return result;
+    std::sort(samples.begin(), samples.end());
+    // Nearest-rank percentiles
+    const auto rank = [&samples](const double p) {
+        const auto n = static_cast<double>(samples.size());
+        const auto i = static_cast<size_t>(std::max(1.0, std::ceil(p / 100.0 * n))) - 1;
+        return samples[std::min(i, samples.size() - 1)];
+    };
+    result.min = samples.front();
+    result.median = rank(50.0);
+    result.p95 = rank(95.0);
+    result.p99 = rank(99.0);
+    return result;
+}
+
+size_t Benchmark::peak_rss_bytes() {
+#if defined(__unix__) || defined(__APPLE__)
+    rusage usage{};
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#if defined(__APPLE__)
+    return static_cast<size_t>(usage.ru_maxrss);
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#else
+    return 0;
+#endif
+}
+
+void Benchmark::print_json(const std::vector<PageTimes> &pages, const PageTimes &all, const int failed) {
+    const auto print_stages = [](const PageTimes &times) {
+        std::cout << "{";
+        bool first = true;
+        for (int s = 0; s < STAGE_COUNT; s++) {
+            if (times.ms[s].empty()) continue;
+            const Stats st = stats(times.ms[s]);
+            std::cout << (first ? "" : ", ") << "\"" << stage_names[s] << "\": {\"min\": " << st.min
+                      << ", \"median\": " << st.median << ", \"p95\": " << st.p95 << ", \"p99\": " << st.p99 << "}";
+            first = false;
+        }
+        std::cout << "}";
+    };
+
+    std::cout << "{\n  \"pages\": " << pages.size() << ",\n  \"reps\": " << options.reps
+              << ",\n  \"stream\": \"" << (options.mapped ? "mmap" : "file") << "\""
+              << ",\n  \"open_ms\": " << open_ms
+              << ",\n  \"dpi\": " << options.dpi << ",\n  \"failed\": " << failed
+              << ",\n  \"peak_heap_bytes\": " << AllocTracker::peak_bytes()
+              << ",\n  \"peak_rss_bytes\": " << peak_rss_bytes()
+              << ",\n  \"native_format\": \"" << SDL_GetPixelFormatName(native_format) << "\""
+              << ",\n  \"upload_mb_per_s\": {\"rgb24\": " << upload_mb_per_s(0)
+              << ", \"native\": " << upload_mb_per_s(1) << "}"
+              << ",\n  \"all_ms\": ";
+    print_stages(all);
+    std::cout << ",\n  \"page_ms\": [";
+    for (size_t p = 0; p < pages.size(); p++) {
+        std::cout << (p ? ",\n    " : "\n    ") << "{\"page\": " << p + 1 << ", \"stages\": ";
+        print_stages(pages[p]);
+        std::cout << "}";
+    }
+    std::cout << "\n  ]\n}" << std::endl;
+}
+
+void Benchmark::print_csv(const std::vector<PageTimes> &pages, const PageTimes &all) {
+    std::cout << "page,stage,min_ms,median_ms,p95_ms,p99_ms\n";
+    const auto print_rows = [](const std::string &page, const PageTimes &times) {
+        for (int s = 0; s < STAGE_COUNT; s++) {
+            if (times.ms[s].empty()) continue;
+            const Stats st = stats(times.ms[s]);
+            std::cout << page << "," << stage_names[s] << "," << st.min << "," << st.median << ","
+                      << st.p95 << "," << st.p99 << "\n";
+        }
+    };
+    for (size_t p = 0; p < pages.size(); p++) {
+        print_rows(std::to_string(p + 1), pages[p]);
+    }
+    print_rows("all", all);
+    std::cout.flush();
+    // Keeps stdout a plain table
+    std::cerr << "stream=" << (options.mapped ? "mmap" : "file") << " open_ms=" << open_ms
+              << " peak_heap_bytes=" << AllocTracker::peak_bytes()
+              << " peak_rss_bytes=" << peak_rss_bytes()
+              << " native_format=" << SDL_GetPixelFormatName(native_format)
+              << " upload_mb_per_s_rgb24=" << upload_mb_per_s(0)
+              << " upload_mb_per_s_native=" << upload_mb_per_s(1) << std::endl;
+}
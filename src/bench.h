@@ -0,0 +1,72 @@
+#ifndef PDFF_BENCH_H
+#define PDFF_BENCH_H
+#include <string>
+#include <vector>
+#include <SDL2/SDL.h>
+
+extern "C" {
+    #include <mupdf/fitz.h>
+}
+
+#include "mu_locks.h"
+#include "render_pool.h"
+
+struct BenchOptions {
+    std::string input;
+    int reps = 5;
+    float dpi = 72.0f;
+    bool csv = false; // JSON otherwise
+    // Compare with false to measure the mapped stream against MuPDF's own
+    bool mapped = true;
+};
+
+// `pdff --bench`: times every stage of getting a page on screen, page by
+// page, single threaded so the numbers do not depend on scheduling. Stats
+// go to stdout as JSON or CSV. Rasterizing and uploading are timed twice:
+// as RGB24 and in the renderer's native texture format.
+class Benchmark {
+    public:
+        explicit Benchmark(BenchOptions options);
+        ~Benchmark();
+        Benchmark(const Benchmark &) = delete;
+        Benchmark &operator=(const Benchmark &) = delete;
+
+        // Returns the process exit status
+        int run();
+    private:
+        enum Stage { LOAD, STEXT, LIST, RASTER, UPLOAD, RASTER_NATIVE, UPLOAD_NATIVE, TOTAL, STAGE_COUNT };
+        static const char *stage_names[STAGE_COUNT];
+
+        // Milliseconds per repetition, for each stage
+        struct PageTimes {
+            std::vector<double> ms[STAGE_COUNT];
+        };
+        struct Stats {
+            double min = 0, median = 0, p95 = 0, p99 = 0;
+        };
+
+        BenchOptions options;
+        MuLocks locks;
+        double open_ms = 0.0;
+        fz_context *ctx = nullptr;
+        fz_document *doc = nullptr;
+        // Hidden window, only there so uploads hit a real renderer
+        SDL_Window *window = nullptr;
+        SDL_Renderer *renderer = nullptr;
+        Uint32 native_format = SDL_PIXELFORMAT_RGB24;
+        PixelFormat native_layout;
+        // Bytes uploaded and milliseconds it took, RGB24 then native
+        double upload_bytes[2] = {};
+        double upload_ms[2] = {};
+
+        bool time_page(int page_num, PageTimes *times);
+        double time_upload(const fz_pixmap *pix, Uint32 format);
+        double upload_mb_per_s(int path) const;
+        static Stats stats(std::vector<double> samples);
+        static size_t peak_rss_bytes();
+        void print_json(const std::vector<PageTimes> &pages, const PageTimes &all, int failed);
+        void print_csv(const std::vector<PageTimes> &pages, const PageTimes &all);
+};
+
+
+#endif //PDFF_BENCH_H
@@ -1,147 +1,517 @@
 #include <string>
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#if defined(__unix__)
+#include <unistd.h>
+#endif
 #include "core.h"
 
+// Rendering more pixels than the screen shows is opt-in (PDFF_SUPERSAMPLE)
+static constexpr float default_supersample = 1.0f;
+
+// Zoom is relative to fitting the page in the window
+static constexpr float min_zoom = 0.5f;
+static constexpr float max_zoom = 32.0f;
+// Continuous mode can zoom out further, to see many pages at once
+static constexpr float min_continuous_zoom = 1.0f / 8.0f;
+static constexpr float zoom_step = 1.25f;
+
+// Scroll steps in continuous mode, in output pixels
+static constexpr float wheel_step = 60.0f;
+static constexpr float line_step = 40.0f;
+
+// Thumbnail strip: space around each thumbnail, and how many rows beyond
+// the visible ones are rendered ahead
+static constexpr int thumb_margin = 8;
+static constexpr int thumb_lookahead = 8;
+static constexpr int thumb_atlas_textures = 2;
+
+// Pages kept rendered around the visible ones, counted in reading direction
+static constexpr int prefetch_ahead = 2;
+static constexpr int prefetch_behind = 1;
+
+// Display lists of vector-heavy drawings can be tens of MB each
+static constexpr size_t default_list_cache_mb = 256;
+static constexpr size_t default_tile_cache_mb = 256;
+// Search index in memory; pages past it are searched in full
+static constexpr size_t default_text_index_mb = 64;
+// Per document, on disk
+static constexpr size_t default_raster_cache_mb = 128;
+// Unused tile textures kept for the next tiles
+static constexpr size_t texture_pool_bytes = 48 * 1024 * 1024;
+
+// Cache growth worth trimming the resource store for, and how often the
+// resident size is checked against the memory limit
+static constexpr size_t cache_growth_step = 32 * 1024 * 1024;
+static constexpr Uint32 memory_check_ms = 1000;
+// Renders shorter than progress_delay_ms never show the progress bar
+static constexpr Uint32 progress_delay_ms = 150;
+static constexpr Uint32 progress_poll_ms = 50;
+// A resize counts as settled once the size held for this long
+static constexpr Uint32 resize_settle_ms = 16;
+
+static float env_float(const char *name, const float fallback) {
+    const char *value = std::getenv(name);
+    if (!value || !*value) return fallback;
+    const float parsed = std::strtof(value, nullptr);
+    return parsed > 0.0f ? parsed : fallback;
+}
+
+size_t PDFCore::env_megabytes(const char *name, const size_t fallback) {
+    const char *value = std::getenv(name);
+    if (!value || !*value) return fallback * 1024 * 1024;
+    return std::strtoull(value, nullptr, 10) * 1024 * 1024;
+}
+
+PDFCore::PDFCore(const size_t store_bytes, const size_t memory_limit)
+    : ctx(fz_new_context(AllocTracker::get(), locks.get(), store_bytes)), memory_limit(memory_limit) {
+}
+
+// Nothing is drawn unless asked for, so uncovering, restoring or resizing
+// the window has to ask; focus and pointer crossings change nothing
+static bool shows_new_content(const Uint8 window_event) {
+    return window_event == SDL_WINDOWEVENT_EXPOSED || window_event == SDL_WINDOWEVENT_SIZE_CHANGED
+        || window_event == SDL_WINDOWEVENT_RESTORED || window_event == SDL_WINDOWEVENT_SHOWN
+        || window_event == SDL_WINDOWEVENT_MAXIMIZED;
+}
+
+void PDFCore::handle_event(const SDL_Event &event) {
+    PageView view;
+    if (event.type == SDL_QUIT) {
+        running = false;
+    } else if (event.type == render_event) {
+        collect_rendered_pages();
+    } else if (event.type == layout_event) {
+        apply_layout_scan();
+    } else if (event.type == data_event) {
+        on_document_data();
+    } else if (event.type == thumb_event) {
+        collect_thumbnails();
+    } else if (event.type == search_event) {
+        collect_search_hits();
+    } else if (event.type == wake_event) {
+        // Only there to get the periodic checks in run() done
+        wake_timer = 0;
+    } else if (event.type == SDL_TEXTINPUT) {
+        if (search_typing) edit_search(search_query + event.text.text);
+    } else if (event.type == SDL_KEYDOWN && search_typing) {
+        handle_search_key(event.key.keysym);
+    } else if (event.type == SDL_WINDOWEVENT) {
+        if (event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+            // Tiles for the size being left are no use any more;
+            // what is on screen is stretched until the size settles
+            if (!is_resizing) cancel_sharp_renders();
+            update_window_size();
+            is_resizing = true;
+        }
+        if (shows_new_content(event.window.event)) needs_redraw = true;
+    } else if (event.type == SDL_MOUSEBUTTONDOWN) {
+        int mx, my;
+        mouse_position(&mx, &my);
+        if (mx < 0) {
+            // Click in the thumbnail strip
+            const int row_h = ThumbnailRenderer::cell_h + thumb_margin;
+            const int page = static_cast<int>((static_cast<float>(my) + thumb_scroll) / row_h);
+            if (event.button.button == SDL_BUTTON_LEFT && page >= 0 && page < page_count) go_to_page(page);
+        } else if (event.button.button == SDL_BUTTON_LEFT) {
+            if (page_under(my, &sel_page, &view)) {
+                sel_start_pt = screen_to_pdf(mx, my, view.dest, view.bounds);
+                sel_end_pt = sel_start_pt;
+                is_selecting = true;
+                copy_pending = false;
+            }
+        } else {
+            // Middle or right drag pans
+            is_panning = true;
+        }
+    } else if (event.type == SDL_MOUSEMOTION) {
+        if (is_selecting) {
+            // Fast mice send hundreds of these a second; run() takes the
+            // latest position once per frame
+            sel_moved = true;
+        } else if (is_panning) {
+            pan_by(static_cast<float>(event.motion.xrel) * window_scale,
+                   static_cast<float>(event.motion.yrel) * window_scale);
+        }
+    } else if (event.type == SDL_MOUSEBUTTONUP) {
+        if (event.button.button == SDL_BUTTON_LEFT) {
+            if (sel_moved) update_selection();
+            is_selecting = false;
+        } else {
+            is_panning = false;
+        }
+    } else if (event.type == SDL_KEYUP) {
+        const SDL_Keycode key = event.key.keysym.sym;
+        if (skimming && (key == SDLK_RIGHT || key == SDLK_LEFT)) {
+            skimming = false;
+            schedule_renders();
+        }
+    } else if (event.type == SDL_MOUSEWHEEL) {
+        int mx, my;
+        mouse_position(&mx, &my);
+        if (mx < 0) {
+            scroll_thumbnails(-static_cast<float>(event.wheel.y) * wheel_step);
+        } else if (continuous && !(SDL_GetModState() & KMOD_CTRL)) {
+            scroll_by(-static_cast<float>(event.wheel.y) * wheel_step);
+        } else {
+            zoom_at(std::pow(zoom_step, static_cast<float>(event.wheel.y)), mx, my);
+        }
+    }
+
+
+    else if (event.type == SDL_KEYDOWN) {
+        const bool ctrl_pressed = (SDL_GetModState() & KMOD_CTRL);
+
+        if (ctrl_pressed && event.key.keysym.sym == SDLK_c) {
+            copy_selection_to_clipboard();
+        }
+
+        if (ctrl_pressed && event.key.keysym.sym == SDLK_f) {
+            open_search();
+        } else if (event.key.keysym.sym == SDLK_F3) {
+            step_hit((event.key.keysym.mod & KMOD_SHIFT) ? -1 : 1);
+        } else if (event.key.keysym.sym == SDLK_ESCAPE) {
+            close_search(true);
+        }
+
+        // Memory use by category, for diagnosing long sessions
+        if (ctrl_pressed && event.key.keysym.sym == SDLK_m) {
+            AllocTracker::dump(std::cerr);
+        }
+
+        if (ctrl_pressed) {
+            int ww, wh;
+            output_size(&ww, &wh);
+            const SDL_Keycode key = event.key.keysym.sym;
+            if (key == SDLK_EQUALS || key == SDLK_PLUS || key == SDLK_KP_PLUS) {
+                zoom_at(zoom_step, ww / 2, wh / 2);
+            } else if (key == SDLK_MINUS || key == SDLK_KP_MINUS) {
+                zoom_at(1.0f / zoom_step, ww / 2, wh / 2);
+            } else if (key == SDLK_0) {
+                zoom_at(1.0f / zoom, ww / 2, wh / 2);
+            }
+        }
+
+        if (!ctrl_pressed && event.key.keysym.sym == SDLK_v) {
+            set_continuous(!continuous);
+        }
+        if (!ctrl_pressed && event.key.keysym.sym == SDLK_t) {
+            toggle_thumbnails();
+        }
+
+        if (continuous) {
+            int ww, wh;
+            output_size(&ww, &wh);
+            const SDL_Keycode key = event.key.keysym.sym;
+            if (key == SDLK_DOWN) scroll_by(line_step);
+            else if (key == SDLK_UP) scroll_by(-line_step);
+            else if (key == SDLK_PAGEDOWN) scroll_by(static_cast<float>(wh) * 0.9f);
+            else if (key == SDLK_PAGEUP) scroll_by(-static_cast<float>(wh) * 0.9f);
+            else if (key == SDLK_HOME) go_to_page(0);
+            else if (key == SDLK_END) go_to_page(page_count - 1);
+        }
+
+        if (event.key.keysym.sym == SDLK_RIGHT && static_cast<int>(current_page) < page_count - 1) {
+            skimming = event.key.repeat != 0;
+            go_to_page(static_cast<int>(current_page) + 1);
+        } else if (event.key.keysym.sym == SDLK_LEFT && current_page > 0) {
+            skimming = event.key.repeat != 0;
+            go_to_page(static_cast<int>(current_page) - 1);
+        }
+    }
+}
+
+static Uint32 push_wake_event(Uint32, void *param) {
+    SDL_Event wake{};
+    wake.type = *static_cast<const Uint32 *>(param);
+    SDL_PushEvent(&wake);
+    return 0;
+}
+
+void PDFCore::wake_in(const Uint32 ms) {
+    const Uint32 at = SDL_GetTicks() + ms;
+    if (wake_timer != 0) {
+        // One timer at a time; an earlier wake-up covers this one
+        if (SDL_TICKS_PASSED(at, wake_at)) return;
+        SDL_RemoveTimer(wake_timer);
+    }
+    wake_at = at;
+    wake_timer = SDL_AddTimer(ms, push_wake_event, &wake_event);
+}
+
 int PDFCore::run() {
     SDL_Event event{};
-    const int total_pages = fz_count_pages(ctx, doc);
 
      while (running) {
-         int ww, wh, tw, th;
-         SDL_GetWindowSize(window, &ww, &wh);
-         SDL_QueryTexture(current_tex, nullptr, nullptr, &tw, &th);
-         SDL_Rect dest = calculate_dest_rect(ww, wh, tw, th);
-
-        if (SDL_WaitEventTimeout(&event, 10)) {
-            if (event.type == SDL_QUIT) {
-                running = false;
-            } else if (event.type == SDL_WINDOWEVENT) {
-                if (event.window.event == SDL_WINDOWEVENT_RESIZED) {
-                    is_resizing = true;
-                    needs_redraw = true;
-                    // Set timer to 300ms in the future
-                    resize_timer = SDL_GetTicks() + 300;
-                }
-            } else if (event.type == SDL_MOUSEBUTTONDOWN) {
-                if (event.button.button == SDL_BUTTON_LEFT) {
-                    int mx, my;
-                    SDL_GetMouseState(&mx, &my);
-                    // Get current destination rect and page for conversion
-                    SDL_GetWindowSize(window, &ww, &wh);
-                    SDL_QueryTexture(current_tex, nullptr, nullptr, &tw, &th);
-                    dest = calculate_dest_rect(ww, wh, tw, th);
-                    fz_page *page = fz_load_page(ctx, doc, static_cast<int>(current_page));
-                    sel_start_pt = screen_to_pdf(mx, my, dest, page);
-                    sel_end_pt = sel_start_pt;
-                    is_selecting = true;
-                    fz_drop_page(ctx, page);
-                }
-            } else if (event.type == SDL_MOUSEMOTION) {
-                if (is_selecting) {
-                    int mx, my;
-                    SDL_GetMouseState(&mx, &my);
-
-                    SDL_GetWindowSize(window, &ww, &wh);
-                    SDL_QueryTexture(current_tex, nullptr, nullptr, &tw, &th);
-                    dest = calculate_dest_rect(ww, wh, tw, th);
-
-                    fz_page *page = fz_load_page(ctx, doc, static_cast<int>(current_page));
-                    sel_end_pt = screen_to_pdf(mx, my, dest, page);
-                    needs_redraw = true; // Trigger redraw to show the blue highlight
-                    fz_drop_page(ctx, page);
-                }
-            } else if (event.type == SDL_MOUSEBUTTONUP) {
-                if (event.button.button == SDL_BUTTON_LEFT) {
-                    is_selecting = false;
-                }
-            }
+         PageView view;
 
+        if (!page_cache) {
+            // Progressive open still waiting for the start of the document
+            if (SDL_WaitEvent(&event)) {
+                if (event.type == SDL_QUIT) running = false;
+                else if (event.type == data_event) on_document_data();
+                else if (event.type == SDL_WINDOWEVENT && shows_new_content(event.window.event)) needs_redraw = true;
+            }
+            if (needs_redraw) {
+                SDL_SetRenderDrawColor(renderer, 40, 40, 40, 255);
+                SDL_RenderClear(renderer);
+                SDL_RenderPresent(renderer);
+                needs_redraw = false;
+            }
+            continue;
+        }
 
-            else if (event.type == SDL_KEYDOWN) {
-                const bool ctrl_pressed = (SDL_GetModState() & KMOD_CTRL);
+        // Sleep until something happens: input, a worker, or a wake-up
+        // asked for below
+        if (SDL_WaitEvent(&event)) {
+            handle_event(event);
+            // Everything queued meanwhile goes into the same frame
+            while (running && SDL_PollEvent(&event)) {
+                handle_event(event);
+            }
+        }
 
-                if (ctrl_pressed && event.key.keysym.sym == SDLK_c) {
-                    copy_selection_to_clipboard();
-                }
+        if (sel_moved) update_selection();
 
-                if (event.key.keysym.sym == SDLK_RIGHT && current_page < total_pages - 1) {
-                    current_page++;
-
-                    // --- RESET SELECTION ---
-                    is_selecting = false;
-                    sel_start_pt = {0, 0};
-                    sel_end_pt = {0, 0};
-                    // -----------------------
-
-                    SDL_DestroyTexture(current_tex);
-                    current_tex = render_page_to_texture(static_cast<int>(current_page));
-                    needs_redraw = true;
-                } else if (event.key.keysym.sym == SDLK_LEFT && current_page > 0) {
-                    current_page--;
-
-                    // --- RESET SELECTION ---
-                    is_selecting = false;
-                    sel_start_pt = {0, 0};
-                    sel_end_pt = {0, 0};
-                    // -----------------------
-
-                    SDL_DestroyTexture(current_tex);
-                    current_tex = render_page_to_texture(static_cast<int>(current_page));
-                    needs_redraw = true;
-                } else if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_EXPOSED) {
-                    needs_redraw = true;
-                }
+        // Render for the new size once it held for a frame; lists are
+        // cached, so only rasterizing is redone
+        if (is_resizing) {
+            if (output_w == resize_w && output_h == resize_h) {
+                clamp_pan();
+                schedule_renders();
+                is_resizing = false;
+                needs_redraw = true;
+            } else {
+                resize_w = output_w;
+                resize_h = output_h;
             }
         }
 
-        // Check if user stopped resizing
-        if (is_resizing && SDL_TICKS_PASSED(SDL_GetTicks(), resize_timer)) {
-            // Now that they stopped, re-render the PDF for the new size
-            SDL_DestroyTexture(current_tex);
-            current_tex = render_page_to_texture(static_cast<int>(current_page));
-            is_resizing = false;
-            needs_redraw = true;
+        // Memory only grows while something happens, so checking when
+        // woken up anyway is enough
+        if (SDL_TICKS_PASSED(SDL_GetTicks(), next_memory_check)) {
+            relieve_memory_pressure(true);
+            next_memory_check = SDL_GetTicks() + memory_check_ms;
+        }
+        if (SDL_TICKS_PASSED(SDL_GetTicks(), next_progress_check)) {
+            if (update_progress()) needs_redraw = true;
+            next_progress_check = SDL_GetTicks() + progress_poll_ms;
         }
 
         if (needs_redraw) {
             SDL_SetRenderDrawColor(renderer, 40, 40, 40, 255);
             SDL_RenderClear(renderer);
 
-            // Draw PDF
-            SDL_RenderCopy(renderer, current_tex, nullptr, &dest);
+            // Draw PDF, right of the thumbnail strip if it is shown
+            const int strip_w = sidebar_width();
+            const SDL_Rect page_area{strip_w, 0, output_w - strip_w, output_h};
+            if (strip_w > 0) SDL_RenderSetViewport(renderer, &page_area);
+            tiles->begin_frame();
+            int first, last;
+            visible_pages(&first, &last);
+            for (int p = first; p <= last; p++) {
+                if (page_view(p, &view)) {
+                    draw_page(p, view);
+                    draw_search_hits(p, view);
+                } else if (continuous) {
+                    draw_placeholder(p);
+                }
+            }
 
             // --- DRAW SELECTION HIGHLIGHT ---
-            if (is_selecting || (sel_start_pt.x != sel_end_pt.x)) {
-                render_selection(dest, static_cast<int>(current_page));
+            if ((is_selecting || (sel_start_pt.x != sel_end_pt.x)) && page_view(sel_page, &view)) {
+                render_selection(view.dest, sel_page);
+            }
+
+            if (strip_w > 0) {
+                const SDL_Rect strip{0, 0, strip_w, output_h};
+                SDL_RenderSetViewport(renderer, &strip);
+                draw_thumbnails();
+                SDL_RenderSetViewport(renderer, nullptr);
             }
 
+            // Over the thumbnails too, so it starts at the window edge
+            draw_progress();
+            update_title();
             SDL_RenderPresent(renderer);
             needs_redraw = false;
         }
+
+        // Workers and input wake the loop on their own; only a resize
+        // settling and the progress bar need a timer
+        if (is_resizing) wake_in(resize_settle_ms);
+        if (progress_shown >= 0 || (pool && pool->busy())) wake_in(progress_poll_ms);
     }
 
-    SDL_DestroyTexture(current_tex);
+    if (wake_timer != 0) SDL_RemoveTimer(wake_timer);
+
+    // Workers hold clones of ctx and use doc, so they have to go first
+    search.reset();
+    text_index.reset();
+    thumbs.reset();
+    atlas.reset();
+    layout.reset();
+    pool.reset();
+    page_cache.reset();
+    for (const auto &[target, tex] : locked_tiles) {
+        SDL_UnlockTexture(tex);
+        SDL_DestroyTexture(tex);
+    }
+    locked_tiles.clear();
+    tiles.reset();
+    textures.reset();
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     fz_drop_document(ctx, doc);
+    // The document's stream reads from the source
+    source.reset();
     fz_drop_context(ctx);
     SDL_Quit();
 
-    return 0;
+    return open_failed ? 1 : 0;
 }
 
-void PDFCore::open(const std::string &file_path) {
+void PDFCore::open(const std::string &file_path, const bool progressive, const bool mapped) {
+      this->file_path = file_path;
       fz_register_document_handlers(ctx);
-      doc = fz_open_document(ctx, file_path.c_str());
-      SDL_Init(SDL_INIT_VIDEO);
+      DocCache cache(file_path);
+      text_index_path = cache.path("text-index");
+      const size_t raster_budget = env_megabytes("PDFF_RASTER_CACHE_MB", default_raster_cache_mb);
+      if (cache.enabled() && raster_budget > 0) {
+          rasters = std::make_unique<RasterCache>(cache.path("raster"), raster_budget);
+      }
+      SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER);
+      window = SDL_CreateWindow("PDFF Reader", 100, 100, 800, 1000,
+                                SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI);
       SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "1");
       renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
       SDL_RenderSetIntegerScale(renderer, SDL_TRUE); // Keeps text sharp
-      // Initial render
-      current_tex = render_page_to_texture(0);
-      resize_timer = 0;
+      update_window_size();
+      supersample = env_float("PDFF_SUPERSAMPLE", default_supersample);
+      textures = std::make_unique<TexturePool>(renderer, texture_pool_bytes,
+                                               TexturePool::preferred_format(renderer));
+      tiles = std::make_unique<TileCache>(env_megabytes("PDFF_TILE_CACHE_MB", default_tile_cache_mb),
+                                          textures.get());
+
+      // Workers wake the event loop when a page is ready for upload, the
+      // layout scan when it has found more page sizes, a progressive
+      // source when more of the file is in, thumbnail workers when they
+      // have thumbnails
+      render_event = SDL_RegisterEvents(6);
+      layout_event = render_event + 1;
+      data_event = render_event + 2;
+      thumb_event = render_event + 3;
+      search_event = render_event + 4;
+      wake_event = render_event + 5;
       is_resizing = false;
       running = true;
+
+      if (!progressive) {
+          // Readers jump between pages, so no read-ahead
+          doc = cache.open_document(ctx, mapped, MappedStream::Access::random);
+          page_count = fz_count_pages(ctx, doc);
+          start_document();
+          return;
+      }
+
+      // PDFF_PROGRESSIVE_KBPS slows reading down, to watch pages arrive
+      const auto throttle = static_cast<unsigned int>(env_float("PDFF_PROGRESSIVE_KBPS", 0.0f));
+      source = std::make_unique<ProgressiveFile>(file_path, [this] {
+          SDL_Event data{};
+          data.type = data_event;
+          SDL_PushEvent(&data);
+      }, throttle);
+      if (try_open_document()) start_document();
+}
+
+bool PDFCore::try_open_document() {
+    fz_stream *stm = nullptr;
+    bool opened = false;
+    fz_var(stm);
+    fz_try(ctx) {
+        stm = source->open_stream(ctx);
+        doc = fz_open_document_with_stream(ctx, file_path.c_str(), stm);
+        page_count = fz_count_pages(ctx, doc);
+        opened = true;
+    }
+    fz_always(ctx) {
+        fz_drop_stream(ctx, stm);
+    }
+    fz_catch(ctx) {
+        fz_drop_document(ctx, doc);
+        doc = nullptr;
+        if (fz_caught(ctx) == FZ_ERROR_TRYLATER && !source->complete()) {
+            fz_ignore_error(ctx); // the next data event tries again
+        } else {
+            fz_report_error(ctx);
+            open_failed = true;
+            running = false;
+        }
+    }
+    return opened;
+}
+
+void PDFCore::start_document() {
+    page_cache = std::make_unique<PageCache>(ctx, doc, doc_mutex,
+        env_megabytes("PDFF_LIST_CACHE_MB", default_list_cache_mb));
+    pool = std::make_unique<RenderPool>(ctx, *page_cache, RenderPool::default_thread_count(), [this] {
+        SDL_Event ready{};
+        ready.type = render_event;
+        SDL_PushEvent(&ready);
+    }, rasters.get());
+    // Initial render
+    needs_redraw = true;
+    schedule_renders();
+}
+
+void PDFCore::on_document_data() {
+    if (source->failed()) {
+        if (source_complete) return;
+        // Nothing more is coming, so stop waiting; pages already in stay
+        source_complete = true;
+        std::cerr << "Cannot open " << file_path << ": read error while loading" << std::endl;
+        // What did arrive may still be enough for the document to open
+        if (!page_cache && try_open_document()) start_document();
+        if (!page_cache) {
+            open_failed = true;
+            running = false;
+        }
+        incomplete_tiles.clear();
+        needs_redraw = true;
+        return;
+    }
+    if (!page_cache) {
+        if (try_open_document()) start_document();
+        return;
+    }
+    if (source_complete) return;
+    source_complete = source->complete();
+    if (source_complete && text_index) text_index->build();
+
+    // Pages that could not be loaded yet get another go; tiles that failed
+    // were never cached, so schedule_renders() asks for them again
+    thumb_failed.clear();
+    text_pending.clear();
+    for (auto it = preparing.begin(); it != preparing.end();) {
+        fz_rect bounds;
+        it = page_cache->try_get_bounds(ctx, *it, &bounds) ? std::next(it) : preparing.erase(it);
+    }
+    schedule_renders();
+    if (continuous_pending) set_continuous(true);
+
+    // Tiles drawn with holes are cached, so they are only redrawn from here
+    for (auto it = incomplete_tiles.begin(); it != incomplete_tiles.end();) {
+        if (!in_prefetch_window(it->first.page_num)) {
+            it = incomplete_tiles.erase(it);
+            continue;
+        }
+        if (in_flight.insert(it->first).second) pool->submit(it->second);
+        ++it;
+    }
 }
 
 SDL_Rect PDFCore::calculate_dest_rect(const int &win_w, const int &win_h, const int &tex_w, const int &tex_h) {
@@ -165,48 +535,836 @@ SDL_Rect PDFCore::calculate_dest_rect(const int &win_w, const int &win_h, const
         return dest;
 }
 
-SDL_Texture* PDFCore::render_page_to_texture(const int &page_num) {
-    if (current_stext) {
-        fz_drop_stext_page(ctx, current_stext);
+void PDFCore::go_to_page(const int page_num) {
+    reading_direction = page_num >= static_cast<int>(current_page) ? 1 : -1;
+    current_page = page_num;
+
+    // --- RESET SELECTION ---
+    is_selecting = false;
+    sel_start_pt = {0, 0};
+    sel_end_pt = {0, 0};
+    // -----------------------
+
+    // Keep the zoom, start reading the new page from its top
+    if (continuous) {
+        scroll_y = layout->offset(page_num);
+        clamp_pan();
+        current_page = page_num;
+    } else {
+        clamp_pan(true);
+    }
+
+    reveal_thumbnail(page_num);
+
+    // Prefetched tiles make this a texture swap
+    needs_redraw = true;
+    schedule_renders();
+}
+
+void PDFCore::update_window_size() {
+    // Layout works in renderer output pixels, which differ from window
+    // coordinates on HiDPI displays
+    int ww, wh;
+    SDL_GetWindowSize(window, &ww, &wh);
+    if (SDL_GetRendererOutputSize(renderer, &output_w, &output_h) != 0) {
+        output_w = ww;
+        output_h = wh;
+    }
+    window_scale = ww > 0 ? static_cast<float>(output_w) / static_cast<float>(ww) : 1.0f;
+}
+
+void PDFCore::output_size(int *w, int *h) const {
+    // The part of the window pages are laid out in
+    *w = std::max(1, output_w - sidebar_width());
+    *h = output_h;
+}
+
+int PDFCore::sidebar_width() const {
+    return show_thumbnails ? ThumbnailRenderer::cell_w + 2 * thumb_margin : 0;
+}
+
+void PDFCore::mouse_position(int *x, int *y) const {
+    SDL_GetMouseState(x, y);
+    // Relative to the page area; negative over the thumbnail strip
+    *x = static_cast<int>(static_cast<float>(*x) * window_scale) - sidebar_width();
+    *y = static_cast<int>(static_cast<float>(*y) * window_scale);
+}
+
+bool PDFCore::page_view(const int page_num, PageView *view) {
+    if (continuous) return continuous_page_view(page_num, view);
+
+    // Never wait for the document here; a worker will publish the bounds
+    if (!page_cache->try_get_bounds(ctx, page_num, &view->bounds)) return false;
+    int ww, wh;
+    output_size(&ww, &wh);
+    const float pw = view->bounds.x1 - view->bounds.x0;
+    const float ph = view->bounds.y1 - view->bounds.y0;
+    view->fit = calculate_dest_rect(ww, wh, static_cast<int>(pw), static_cast<int>(ph));
+
+    view->dest.w = static_cast<int>(std::lround(static_cast<float>(view->fit.w) * zoom));
+    view->dest.h = static_cast<int>(std::lround(static_cast<float>(view->fit.h) * zoom));
+    view->dest.x = (ww - view->dest.w) / 2 + static_cast<int>(std::lround(pan_x));
+    view->dest.y = (wh - view->dest.h) / 2 + static_cast<int>(std::lround(pan_y));
+
+    // dest is in output pixels, so this renders exactly one page pixel per
+    // screen pixel (HiDPI included) instead of letting SDL downscale
+    view->scale = static_cast<float>(view->dest.w) / pw * supersample;
+    return true;
+}
+
+float PDFCore::continuous_scale() const {
+    // zoom 1 = the first page fills the window width
+    int ww, wh;
+    output_size(&ww, &wh);
+    return static_cast<float>(ww) * zoom / std::max(1.0f, layout->reference_width());
+}
+
+bool PDFCore::continuous_page_view(const int page_num, PageView *view) {
+    // Pure table lookups: nothing here may touch the document per frame
+    if (page_num < 0 || page_num >= layout->page_count() || !layout->known(page_num)) return false;
+    int ww, wh;
+    output_size(&ww, &wh);
+    const float s = continuous_scale();
+    view->bounds = layout->bounds(page_num);
+    const float pw = view->bounds.x1 - view->bounds.x0;
+    const float ph = view->bounds.y1 - view->bounds.y0;
+
+    view->dest.w = static_cast<int>(std::lround(pw * s));
+    view->dest.h = static_cast<int>(std::lround(ph * s));
+    view->dest.x = (ww - view->dest.w) / 2 + static_cast<int>(std::lround(pan_x));
+    view->dest.y = static_cast<int>(std::lround((layout->offset(page_num) - scroll_y) * s));
+    view->fit = view->dest;
+    view->scale = s * supersample;
+    return true;
+}
+
+bool PDFCore::page_under(const int my, int *page_num, PageView *view) {
+    if (!continuous) {
+        *page_num = static_cast<int>(current_page);
+    } else {
+        *page_num = layout->page_at(scroll_y + static_cast<double>(my) / continuous_scale());
+    }
+    return page_view(*page_num, view);
+}
+
+void PDFCore::visible_pages(int *first, int *last) const {
+    if (!continuous) {
+        *first = *last = static_cast<int>(current_page);
+        return;
+    }
+    int ww, wh;
+    output_size(&ww, &wh);
+    *first = layout->page_at(scroll_y);
+    *last = layout->page_at(scroll_y + static_cast<double>(wh) / continuous_scale());
+}
+
+void PDFCore::set_continuous(const bool enable) {
+    continuous_pending = false;
+    if (enable == continuous) return;
+    if (enable && !layout) {
+        // Built on first use; the scan fills in real page sizes behind us
+        fz_rect first_bounds;
+        if (!page_cache->try_get_bounds(ctx, 0, &first_bounds)) {
+            // Switched over once a worker has loaded the first page
+            continuous_pending = true;
+            prepare_page(0, false);
+            return;
+        }
+        layout = std::make_unique<PageLayout>(page_count, first_bounds);
+        layout->start_scan(ctx, *page_cache, [this] {
+            SDL_Event scanned{};
+            scanned.type = layout_event;
+            SDL_PushEvent(&scanned);
+        });
+    }
+    continuous = enable;
+    zoom = 1.0f;
+    pan_x = pan_y = 0.0f;
+    if (continuous) scroll_y = layout->offset(static_cast<int>(current_page));
+    clamp_pan(true);
+    needs_redraw = true;
+    schedule_renders();
+}
+
+void PDFCore::apply_layout_scan() {
+    if (!layout) return;
+    // Keep the page at the top of the window where it is while the pages
+    // above it change size
+    const int anchor = layout->page_at(scroll_y);
+    const double into_anchor = scroll_y - layout->offset(anchor);
+    if (!layout->apply_scanned()) return;
+    if (continuous) {
+        scroll_y = layout->offset(anchor) + into_anchor;
+        clamp_pan();
+        needs_redraw = true;
+        schedule_renders();
+    }
+}
+
+void PDFCore::scroll_by(const float dy) {
+    scroll_y += dy / continuous_scale();
+    clamp_pan();
+    needs_redraw = true;
+    schedule_renders();
+}
+
+void PDFCore::update_current_from_scroll() {
+    // The page in the middle of the window is the current one
+    int ww, wh;
+    output_size(&ww, &wh);
+    const int page = layout->page_at(scroll_y + static_cast<double>(wh) / 2.0 / continuous_scale());
+    if (page == static_cast<int>(current_page)) return;
+    reading_direction = page > static_cast<int>(current_page) ? 1 : -1;
+    current_page = page;
+}
+
+float PDFCore::preview_scale(const fz_rect &bounds) {
+    // The whole page in a single tile
+    return static_cast<float>(TileGrid::tile_size) / std::max(bounds.x1 - bounds.x0, bounds.y1 - bounds.y0);
+}
+
+void PDFCore::zoom_at(const float factor, const int mx, const int my) {
+    if (continuous) {
+        const float new_zoom = std::clamp(zoom * factor, min_continuous_zoom, max_zoom);
+        if (new_zoom == zoom) return;
+        int ww, wh;
+        output_size(&ww, &wh);
+        // Keep the document point under (mx, my) where it is
+        const float s = continuous_scale();
+        const double doc_y = scroll_y + my / s;
+        const float doc_x = (static_cast<float>(mx) - static_cast<float>(ww) / 2.0f - pan_x) / s;
+        zoom = new_zoom;
+        const float new_s = continuous_scale();
+        scroll_y = doc_y - my / new_s;
+        pan_x = static_cast<float>(mx) - static_cast<float>(ww) / 2.0f - doc_x * new_s;
+        clamp_pan();
+        needs_redraw = true;
+        schedule_renders();
+        return;
+    }
+
+    PageView before;
+    if (!page_view(static_cast<int>(current_page), &before)) return;
+    const float new_zoom = std::clamp(zoom * factor, min_zoom, max_zoom);
+    if (new_zoom == zoom) return;
+
+    // Keep the page point under (mx, my) where it is
+    const float u = (static_cast<float>(mx) - before.dest.x) / static_cast<float>(before.dest.w);
+    const float v = (static_cast<float>(my) - before.dest.y) / static_cast<float>(before.dest.h);
+    int ww, wh;
+    output_size(&ww, &wh);
+    const float w = static_cast<float>(before.fit.w) * new_zoom;
+    const float h = static_cast<float>(before.fit.h) * new_zoom;
+    pan_x = static_cast<float>(mx) - u * w - (static_cast<float>(ww) - w) / 2.0f;
+    pan_y = static_cast<float>(my) - v * h - (static_cast<float>(wh) - h) / 2.0f;
+    zoom = new_zoom;
+    clamp_pan();
+
+    // Until the sharp tiles arrive draw_page stretches what it has
+    needs_redraw = true;
+    schedule_renders();
+}
+
+void PDFCore::pan_by(const float dx, const float dy) {
+    pan_x += dx;
+    if (continuous) {
+        scroll_y -= dy / continuous_scale();
+    } else {
+        pan_y += dy;
+    }
+    clamp_pan();
+    needs_redraw = true;
+    schedule_renders();
+}
+
+void PDFCore::clamp_pan(const bool align_top) {
+    if (continuous) {
+        int ww, wh;
+        output_size(&ww, &wh);
+        const float s = continuous_scale();
+        const float slack_x = std::max(0.0f, (layout->reference_width() * s - static_cast<float>(ww)) / 2.0f);
+        pan_x = std::clamp(pan_x, -slack_x, slack_x);
+        pan_y = 0.0f;
+        const double max_scroll = std::max(0.0, layout->total_height() - wh / s);
+        scroll_y = std::clamp(scroll_y, 0.0, max_scroll);
+        update_current_from_scroll();
+        return;
+    }
+
+    PageView view;
+    if (!page_view(static_cast<int>(current_page), &view)) {
+        pan_x = pan_y = 0.0f;
+        return;
+    }
+    int ww, wh;
+    output_size(&ww, &wh);
+    // A page smaller than the window stays centered, a larger one can be
+    // moved until its edge reaches the window edge
+    const float slack_x = std::max(0.0f, static_cast<float>(view.dest.w - ww) / 2.0f);
+    const float slack_y = std::max(0.0f, static_cast<float>(view.dest.h - wh) / 2.0f);
+    if (align_top) pan_y = slack_y;
+    pan_x = std::clamp(pan_x, -slack_x, slack_x);
+    pan_y = std::clamp(pan_y, -slack_y, slack_y);
+}
+
+bool PDFCore::in_prefetch_window(const int page_num) const {
+    return page_num >= prefetch_first && page_num <= prefetch_last;
+}
+
+void PDFCore::update_prefetch_window() {
+    int first, last;
+    visible_pages(&first, &last);
+    if (skimming) {
+        prefetch_first = first;
+        prefetch_last = last;
+        return;
+    }
+    prefetch_first = first - (reading_direction > 0 ? prefetch_behind : prefetch_ahead);
+    prefetch_last = last + (reading_direction > 0 ? prefetch_ahead : prefetch_behind);
+}
+
+bool PDFCore::visible_tiles(const int page_num, TileRange *range) {
+    PageView view;
+    if (!page_view(page_num, &view)) return false;
+    int ww, wh;
+    output_size(&ww, &wh);
+    range->zoom = TileKey::zoom_key(view.scale);
+    range->preview_zoom = TileKey::zoom_key(preview_scale(view.bounds));
+    visible_tile_range(TileGrid(view.bounds, view.scale), to_frect(view.dest), ww, wh,
+                                              &range->x0, &range->y0, &range->x1, &range->y1);
+    return true;
+}
+
+void PDFCore::schedule_renders() {
+    update_prefetch_window();
+    int first, last;
+    visible_pages(&first, &last);
+
+    // What each page in the prefetch window needs right now
+    std::unordered_map<int, TileRange> ranges;
+    for (int p = std::max(prefetch_first, 0); p <= std::min(prefetch_last, page_count - 1); p++) {
+        TileRange range;
+        if (visible_tiles(p, &range)) ranges[p] = range;
+    }
+    const auto wanted = [this, &ranges](const TileKey &key) {
+        if (!in_prefetch_window(key.page_num)) return false;
+        const auto it = ranges.find(key.page_num);
+        if (it == ranges.end()) return true;
+        const TileRange &range = it->second;
+        if (key.zoom == range.preview_zoom) return true;
+        return key.zoom == range.zoom && key.x >= range.x0 && key.x < range.x1
+            && key.y >= range.y0 && key.y < range.y1;
+    };
+
+    // Whatever is running for pages we jumped away from, old zoom levels or
+    // tiles panned out of view only competes with what is on screen
+    pool->cancel_if([this, &wanted](const RenderJob &job) {
+        // Text jobs are waited on by a selection, wherever it is
+        if (job.prepare_only) return !job.warm_text && !keep_preparing(job.page_num);
+        return !wanted({job.page_num, TileKey::zoom_key(job.scale), job.tile_x, job.tile_y});
+    });
+    for (auto it = in_flight.begin(); it != in_flight.end();) {
+        it = !wanted(*it) ? in_flight.erase(it) : std::next(it);
+    }
+    for (auto it = preparing.begin(); it != preparing.end();) {
+        it = !keep_preparing(*it) ? preparing.erase(it) : std::next(it);
+    }
+    for (auto it = shown_scale.begin(); it != shown_scale.end();) {
+        it = !in_prefetch_window(it->first) ? shown_scale.erase(it) : std::next(it);
+    }
+
+    for (int p = first; p <= last; p++) {
+        request_page(p, false);
+    }
+    if (skimming) {
+        schedule_thumbnails();
+        return;
+    }
+    const int ahead_from = reading_direction > 0 ? last : first;
+    const int behind_from = reading_direction > 0 ? first : last;
+    for (int i = 1; i <= prefetch_ahead; i++) {
+        request_page(ahead_from + reading_direction * i, true);
+    }
+    for (int i = 1; i <= prefetch_behind; i++) {
+        request_page(behind_from - reading_direction * i, true);
+    }
+    schedule_thumbnails();
+}
+
+void PDFCore::request_tile(const int page_num, const float scale, const TileGrid &grid,
+                           const int x, const int y, const bool speculative, const bool warm_text,
+                           const bool persist) {
+    const TileKey key{page_num, TileKey::zoom_key(scale), x, y};
+    if (tiles->contains(key) || !in_flight.insert(key).second) return;
+
+    RenderJob job;
+    job.page_num = page_num;
+    job.scale = scale;
+    job.area = grid.tile(x, y);
+    job.tile_x = x;
+    job.tile_y = y;
+    job.speculative = speculative;
+    job.warm_text = warm_text;
+    job.persist = persist;
+    // Workers put the tile right into texture memory, locked until the
+    // job comes back
+    if (SDL_Texture *tex = textures->acquire(job.area.x1 - job.area.x0, job.area.y1 - job.area.y0)) {
+        void *pixels = nullptr;
+        int pitch = 0;
+        if (SDL_LockTexture(tex, nullptr, &pixels, &pitch) == 0) {
+            job.target = static_cast<unsigned char *>(pixels);
+            job.target_pitch = pitch;
+            job.target_format = textures->layout();
+            locked_tiles[job.target] = tex;
+        } else {
+            textures->release(tex);
+        }
+    }
+    pool->submit(job);
+    // The document lock is needed for the page on screen
+    if (thumbs && !speculative) thumbs->yield();
+}
+
+void PDFCore::prepare_page(const int page_num, const bool speculative) {
+    if (!preparing.insert(page_num).second) return;
+    RenderJob job;
+    job.page_num = page_num;
+    job.prepare_only = true;
+    job.speculative = speculative;
+    pool->submit(job);
+}
+
+bool PDFCore::keep_preparing(const int page_num) const {
+    return in_prefetch_window(page_num) || (continuous_pending && page_num == 0);
+}
+
+void PDFCore::request_text(const int page_num) {
+    if (!text_pending.insert(page_num).second) return;
+    RenderJob job;
+    job.page_num = page_num;
+    job.prepare_only = true;
+    job.warm_text = true;
+    pool->submit(job);
+}
+
+void PDFCore::request_page(const int page_num, const bool speculative) {
+    if (page_num < 0 || page_num >= page_count) return;
+
+    PageView view;
+    if (!page_view(page_num, &view)) {
+        // Let a worker load the page first; its result reschedules us
+        prepare_page(page_num, speculative);
+        return;
+    }
+
+    // A cheap whole-page preview goes first so there is something to
+    // stretch while the sharp tiles are rendered
+    const float low_scale = preview_scale(view.bounds);
+    request_tile(page_num, low_scale, TileGrid(view.bounds, low_scale), 0, 0, speculative, !speculative, true);
+
+    int ww, wh;
+    output_size(&ww, &wh);
+    const TileGrid grid(view.bounds, view.scale);
+    int x0, y0, x1, y1;
+    visible_tile_range(grid, to_frect(view.dest), ww, wh, &x0, &y0, &x1, &y1);
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            // Other zoom levels are too many and too short-lived to keep
+            request_tile(page_num, view.scale, grid, x, y, speculative, false, zoom == 1.0f);
+        }
+    }
+}
+
+void PDFCore::collect_rendered_pages() {
+    bool reschedule = false;
+    for (const auto &result : pool->take_results()) {
+        const RenderJob &job = result.job;
+        if (job.prepare_only) {
+            // Text that could not be extracted stays marked so it is not
+            // asked for again on every frame
+            if (result.stext) {
+                text_pending.erase(job.page_num);
+                if (copy_pending && job.page_num == sel_page) {
+                    copy_pending = false;
+                    copy_selection_text(result.stext);
+                }
+                fz_drop_stext_page(ctx, result.stext);
+                needs_redraw = true;
+            }
+            // A page that failed to load stays marked so it is not retried
+            fz_rect bounds;
+            if (page_cache->try_get_bounds(ctx, job.page_num, &bounds)) {
+                preparing.erase(job.page_num);
+                if (layout && !layout->known(job.page_num)) {
+                    apply_layout_scan();
+                    layout->set_bounds(job.page_num, bounds);
+                }
+                if (continuous_pending && job.page_num == 0) set_continuous(true);
+                reschedule = true;
+            }
+            continue;
+        }
+
+        SDL_Texture *target = nullptr;
+        if (const auto it = locked_tiles.find(job.target); job.target && it != locked_tiles.end()) {
+            target = it->second;
+            locked_tiles.erase(it);
+        }
+        if (result.cancelled) {
+            if (target) {
+                SDL_UnlockTexture(target);
+                textures->release(target);
+            }
+            continue;
+        }
+
+        const TileKey key{job.page_num, TileKey::zoom_key(job.scale), job.tile_x, job.tile_y};
+        in_flight.erase(key);
+        if (result.errors > 0 && error_pages.insert(job.page_num).second) {
+            std::cerr << "Page " << job.page_num + 1 << ": " << result.errors
+                      << " error(s) while drawing, some content may be missing" << std::endl;
+        }
+        if (result.incomplete) {
+            // Its texture is handed on below; the redraw gets a pixmap
+            RenderJob redo = job;
+            redo.target = nullptr;
+            redo.target_pitch = 0;
+            redo.target_format = {};
+            incomplete_tiles[key] = redo;
+        } else {
+            incomplete_tiles.erase(key);
+        }
+        if (result.pix && in_prefetch_window(job.page_num)) {
+            // Charged what the texture holds, not the pixmap
+            const size_t bytes = textures->texture_bytes(result.pix->w, result.pix->h);
+            SDL_Texture *tex = result.in_target ? target : pixmap_to_texture(result.pix);
+            fz_drop_pixmap(ctx, result.pix);
+            if (result.in_target) {
+                // Unlocking uploads what the worker drew
+                SDL_UnlockTexture(target);
+                target = nullptr;
+            }
+            if (tex) {
+                tiles->insert(key, tex, bytes);
+                int first, last;
+                visible_pages(&first, &last);
+                if (job.page_num >= first && job.page_num <= last) needs_redraw = true;
+            }
+        } else {
+            fz_drop_pixmap(ctx, result.pix);
+        }
+        if (target) {
+            SDL_UnlockTexture(target);
+            textures->release(target);
+        }
+    }
+    if (reschedule) {
+        schedule_renders();
+        needs_redraw = true;
+    }
+    relieve_memory_pressure(false);
+}
+
+bool PDFCore::update_progress() {
+    if (!pool) return false;
+    const RenderProgress progress = pool->progress();
+    const Uint32 now = SDL_GetTicks();
+    int shown = -1;
+    if (progress.jobs == 0) {
+        progress_since = 0;
+    } else {
+        if (progress_since == 0) progress_since = now;
+        // Jobs still recording their list have no total yet and count as 0
+        if (now - progress_since >= progress_delay_ms) {
+            shown = progress.total > 0 ? static_cast<int>(progress.done * 1000 / progress.total) : 0;
+        }
+    }
+    if (shown == progress_shown) return false;
+    progress_shown = shown;
+    return true;
+}
+
+void PDFCore::draw_progress() {
+    if (progress_shown < 0) return;
+    const int bar_h = std::max(2, static_cast<int>(std::lround(3.0f * window_scale)));
+    const SDL_Rect track{0, 0, output_w, bar_h};
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 80);
+    SDL_RenderFillRect(renderer, &track);
+    const SDL_Rect fill{0, 0, output_w * progress_shown / 1000, bar_h};
+    SDL_SetRenderDrawColor(renderer, 0, 120, 215, 255);
+    SDL_RenderFillRect(renderer, &fill);
+}
+
+void PDFCore::update_title() {
+    std::string title = "PDFF Reader - " + std::to_string(current_page + 1) + " / " + std::to_string(page_count);
+    if (error_pages.count(static_cast<int>(current_page))) title += " (errors on this page)";
+    const bool page_incomplete = std::any_of(incomplete_tiles.begin(), incomplete_tiles.end(),
+        [this](const auto &entry) { return entry.first.page_num == static_cast<int>(current_page); });
+    if (page_incomplete) title += " (loading)";
+    if (search_typing || !search_query.empty()) {
+        title += " - Find: " + search_query + (search_typing ? "_" : "");
+        if (!search_query.empty()) {
+            const int searched = search ? search->pages_searched() : 0;
+            if (search_hit_count == 0) {
+                title += " (no matches";
+            } else if (hit_page < 0) {
+                title += " (" + std::to_string(search_hit_count) + " matches";
+            } else {
+                int ordinal = hit_index + 1;
+                for (auto it = search_hits.begin(); it->first != hit_page; ++it) {
+                    ordinal += static_cast<int>(it->second.size());
+                }
+                title += " (" + std::to_string(ordinal) + " of " + std::to_string(search_hit_count);
+            }
+            if (searched < page_count) title += ", " + std::to_string(searched * 100 / page_count) + "% searched";
+            title += ")";
+        }
+    }
+    if (title == title_shown) return;
+    SDL_SetWindowTitle(window, title.c_str());
+    title_shown = title;
+}
+
+void PDFCore::relieve_memory_pressure(const bool check_rss) {
+    // Fonts and images just turned into lists and tiles are the store items
+    // least likely to be needed again soon, so give back what our caches took
+    const size_t cached = page_cache->used_bytes() + tiles->used_bytes()
+        + (text_index ? text_index->used_bytes() : 0);
+    if (cached > cache_bytes_seen + cache_growth_step) {
+        int phase = 0;
+        fz_store_scavenge_external(ctx, cached - cache_bytes_seen, &phase);
+        cache_bytes_seen = cached;
+    } else if (cached < cache_bytes_seen) {
+        cache_bytes_seen = cached;
+    }
+
+    if (!check_rss || memory_limit == 0) return;
+    const size_t rss = resident_bytes();
+    if (rss > memory_limit) {
+        fz_empty_store(ctx);
+        textures->clear();
+    } else if (rss > memory_limit / 10 * 9) {
+        fz_shrink_store(ctx, 50);
+    }
+}
+
+size_t PDFCore::resident_bytes() {
+#if defined(__unix__)
+    // Second field of statm: resident pages
+    std::ifstream statm("/proc/self/statm");
+    size_t total_pages = 0, resident_pages = 0;
+    if (statm >> total_pages >> resident_pages) {
+        return resident_pages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    }
+#endif
+    return 0;
+}
+
+void PDFCore::draw_page(const int page_num, const PageView &view) {
+    // Paper first, so tiles still in flight show up as blank page
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    SDL_RenderFillRect(renderer, &view.dest);
+
+    // Low-res preview stretched over the page, sharp tiles on top of it
+    const SDL_FRect page_dest = to_frect(view.dest);
+    const float low_scale = preview_scale(view.bounds);
+    if (SDL_Texture *preview = tiles->find({page_num, TileKey::zoom_key(low_scale), 0, 0})) {
+        SDL_RenderCopyF(renderer, preview, nullptr, &page_dest);
     }
-    fz_page *page = fz_load_page(ctx, doc, page_num);
-    current_stext = fz_new_stext_page_from_page(ctx, page, nullptr);
 
+    // Sharp tiles of the scale last shown in full stand in for the ones
+    // still being drawn after a resize or zoom
+    const auto shown = shown_scale.find(page_num);
+    if (shown != shown_scale.end() && TileKey::zoom_key(shown->second) != TileKey::zoom_key(view.scale)) {
+        draw_tiles(page_num, view, shown->second);
+    }
+    if (draw_tiles(page_num, view, view.scale)) shown_scale[page_num] = view.scale;
+}
+
+bool PDFCore::draw_tiles(const int page_num, const PageView &view, const float scale) {
+    int ww, wh;
+    output_size(&ww, &wh);
+    const SDL_FRect page_dest = to_frect(view.dest);
+    const TileGrid grid(view.bounds, scale);
+    int x0, y0, x1, y1;
+    visible_tile_range(grid, page_dest, ww, wh, &x0, &y0, &x1, &y1);
+
+    bool complete = true;
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            SDL_Texture *tex = tiles->find({page_num, TileKey::zoom_key(scale), x, y});
+            if (!tex) {
+                complete = false;
+                continue;
+            }
+            // Float rects keep neighbouring tiles from leaving seams
+            const SDL_FRect where = tile_dest(grid, x, y, page_dest);
+            SDL_RenderCopyF(renderer, tex, nullptr, &where);
+        }
+    }
+    return complete;
+}
+
+void PDFCore::cancel_sharp_renders() {
+    // Previews do not depend on the window size and are kept
+    std::unordered_map<int, int> preview_zoom;
+    for (const TileKey &key : in_flight) {
+        fz_rect bounds;
+        if (!preview_zoom.count(key.page_num) && page_cache->try_get_bounds(ctx, key.page_num, &bounds)) {
+            preview_zoom[key.page_num] = TileKey::zoom_key(preview_scale(bounds));
+        }
+    }
+    const auto is_preview = [&preview_zoom](const int page_num, const int zoom) {
+        const auto it = preview_zoom.find(page_num);
+        return it != preview_zoom.end() && it->second == zoom;
+    };
+    pool->cancel_if([&is_preview](const RenderJob &job) {
+        return !job.prepare_only && !is_preview(job.page_num, TileKey::zoom_key(job.scale));
+    });
+    for (auto it = in_flight.begin(); it != in_flight.end();) {
+        it = !is_preview(it->page_num, it->zoom) ? in_flight.erase(it) : std::next(it);
+    }
+}
+
+void PDFCore::draw_placeholder(const int page_num) {
+    // Blank paper at the estimated spot of a page whose size is unknown
+    const float s = continuous_scale();
+    const fz_rect &bounds = layout->bounds(page_num);
+    int ww, wh;
+    output_size(&ww, &wh);
+    SDL_Rect dest;
+    dest.w = static_cast<int>(std::lround((bounds.x1 - bounds.x0) * s));
+    dest.h = static_cast<int>(std::lround((bounds.y1 - bounds.y0) * s));
+    dest.x = (ww - dest.w) / 2 + static_cast<int>(std::lround(pan_x));
+    dest.y = static_cast<int>(std::lround((layout->offset(page_num) - scroll_y) * s));
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    SDL_RenderFillRect(renderer, &dest);
+}
 
-  // 1. Maximize Anti-Aliasing
-  fz_set_aa_level(ctx, 8);
+void PDFCore::toggle_thumbnails() {
+    show_thumbnails = !show_thumbnails;
+    if (show_thumbnails && !thumbs) {
+        atlas = std::make_unique<ThumbnailAtlas>(renderer, ThumbnailRenderer::cell_w, ThumbnailRenderer::cell_h,
+                                                 thumb_atlas_textures);
+        // Two workers: the document lock serializes interpretation, but
+        // image decoding and drawing overlap
+        thumbs = std::make_unique<ThumbnailRenderer>(ctx, *page_cache, *pool, 2, [this] {
+            SDL_Event ready{};
+            ready.type = thumb_event;
+            SDL_PushEvent(&ready);
+        });
+    }
+    if (show_thumbnails) reveal_thumbnail(static_cast<int>(current_page));
+    // The page area changed width
+    clamp_pan();
+    needs_redraw = true;
+    schedule_renders();
+}
+
+void PDFCore::scroll_thumbnails(const float dy) {
+    const float row_h = ThumbnailRenderer::cell_h + thumb_margin;
+    const float max_scroll = std::max(0.0f, row_h * static_cast<float>(page_count) + thumb_margin - output_h);
+    thumb_scroll = std::clamp(thumb_scroll + dy, 0.0f, max_scroll);
+    needs_redraw = true;
+    schedule_thumbnails();
+}
 
-  // 2. High Scale (3.0 is the "sweet spot" for 1080p-4k screens)
-  constexpr float scale = 3.0f;
-  const fz_matrix ctm = fz_scale(scale, scale);
+void PDFCore::reveal_thumbnail(const int page_num) {
+    if (!show_thumbnails) return;
+    const float row_h = ThumbnailRenderer::cell_h + thumb_margin;
+    const float top = row_h * static_cast<float>(page_num);
+    if (top < thumb_scroll) {
+        scroll_thumbnails(top - thumb_scroll);
+    } else if (top + row_h + thumb_margin > thumb_scroll + static_cast<float>(output_h)) {
+        scroll_thumbnails(top + row_h + thumb_margin - static_cast<float>(output_h) - thumb_scroll);
+    }
+}
 
-  const fz_rect rect = fz_bound_page(ctx, page);
-  const fz_irect bbox = fz_round_rect(fz_transform_rect(rect, ctm));
+void PDFCore::schedule_thumbnails() {
+    if (!show_thumbnails || !thumbs) return;
+    const float row_h = ThumbnailRenderer::cell_h + thumb_margin;
+    const int first = static_cast<int>(thumb_scroll / row_h);
+    const int last = std::min(page_count - 1,
+                              static_cast<int>((thumb_scroll + static_cast<float>(output_h)) / row_h));
 
-  // 3. Create Pixmap (0 = No alpha, results in cleaner text contrast)
-  fz_pixmap *pix = fz_new_pixmap_with_bbox(ctx, fz_device_rgb(ctx), bbox, nullptr, 0);
-  fz_clear_pixmap_with_value(ctx, pix, 255);
+    // Rows on screen top down, then alternately below and above them
+    std::vector<int> wanted;
+    const auto want = [&](const int page) {
+        if (page >= 0 && page < page_count && !atlas->contains(page) && !thumb_failed.count(page)) {
+            wanted.push_back(page);
+        }
+    };
+    for (int p = first; p <= last; p++) want(p);
+    for (int i = 1; i <= thumb_lookahead; i++) {
+        want(last + i);
+        want(first - i);
+    }
+    thumbs->request(wanted);
+}
 
-  // 4. Render with Draw Device
-  fz_device *dev = fz_new_draw_device(ctx, ctm, pix);
-  fz_run_page(ctx, page, dev, fz_identity, nullptr);
-  fz_close_device(ctx, dev);
-  fz_drop_device(ctx, dev);
+void PDFCore::collect_thumbnails() {
+    for (const auto &thumb : thumbs->take_results()) {
+        if (thumb.pix) {
+            atlas->insert(thumb.page_num, thumb.pix);
+        } else {
+            thumb_failed.insert(thumb.page_num);
+        }
+        fz_drop_pixmap(ctx, thumb.pix);
+    }
+    needs_redraw = true;
+}
 
-  // 5. Use ARGB for better subpixel compatibility with modern GPUs
-  SDL_Texture *tex = SDL_CreateTexture(renderer,
-      SDL_PIXELFORMAT_RGB24, SDL_TEXTUREACCESS_STATIC, pix->w, pix->h);
+void PDFCore::draw_thumbnails() {
+    const int strip_w = sidebar_width();
+    const SDL_Rect background{0, 0, strip_w, output_h};
+    SDL_SetRenderDrawColor(renderer, 28, 28, 28, 255);
+    SDL_RenderFillRect(renderer, &background);
 
-  SDL_UpdateTexture(tex, nullptr, pix->samples, floor(pix->stride));
+    const int row_h = ThumbnailRenderer::cell_h + thumb_margin;
+    const int first = static_cast<int>(thumb_scroll / static_cast<float>(row_h));
+    const int offset = static_cast<int>(std::lround(thumb_scroll));
+    for (int p = first; p < page_count && p * row_h - offset < output_h; p++) {
+        SDL_Rect cell{thumb_margin, p * row_h - offset + thumb_margin, ThumbnailRenderer::cell_w,
+                      ThumbnailRenderer::cell_h};
+        SDL_Texture *tex = nullptr;
+        SDL_Rect src;
+        if (atlas->find(p, &tex, &src)) {
+            // Centered in its cell
+            const SDL_Rect dest{cell.x + (cell.w - src.w) / 2, cell.y + (cell.h - src.h) / 2, src.w, src.h};
+            SDL_RenderCopy(renderer, tex, &src, &dest);
+            cell = dest;
+        } else {
+            SDL_SetRenderDrawColor(renderer, 60, 60, 60, 255);
+            SDL_RenderFillRect(renderer, &cell);
+        }
+        if (p == static_cast<int>(current_page)) {
+            SDL_SetRenderDrawColor(renderer, 0, 120, 215, 255);
+            const SDL_Rect outline{cell.x - 2, cell.y - 2, cell.w + 4, cell.h + 4};
+            SDL_RenderDrawRect(renderer, &outline);
+        }
+    }
+}
 
-  fz_drop_pixmap(ctx, pix);
-  fz_drop_page(ctx, page);
+SDL_FRect PDFCore::to_frect(const SDL_Rect &rect) {
+    return {static_cast<float>(rect.x), static_cast<float>(rect.y),
+            static_cast<float>(rect.w), static_cast<float>(rect.h)};
+}
 
+SDL_Texture* PDFCore::pixmap_to_texture(fz_pixmap *pix) {
+  SDL_Texture *tex = textures->acquire(pix->w, pix->h);
+  if (!tex) return nullptr;
+  void *pixels = nullptr;
+  int pitch = 0;
+  if (SDL_LockTexture(tex, nullptr, &pixels, &pitch) == 0) {
+      SDL_ConvertPixels(pix->w, pix->h, SDL_PIXELFORMAT_RGB24, pix->samples, static_cast<int>(pix->stride),
+                        textures->format(), pixels, pitch);
+      SDL_UnlockTexture(tex);
+  }
   return tex;
 }
 
-fz_point PDFCore::screen_to_pdf(const int mx, const int my, const SDL_Rect& dest, fz_page* page) {
-    const fz_rect &page_rect = fz_bound_page(ctx, page);
+fz_point PDFCore::screen_to_pdf(const int mx, const int my, const SDL_Rect& dest, const fz_rect& page_rect) {
     const float pw = page_rect.x1 - page_rect.x0;
     const float ph = page_rect.y1 - page_rect.y0;
 
@@ -217,40 +1375,67 @@ fz_point PDFCore::screen_to_pdf(const int mx, const int my, const SDL_Rect& dest
     return {pdf_x, pdf_y};
 }
 
+void PDFCore::update_selection() {
+    sel_moved = false;
+    int mx, my;
+    mouse_position(&mx, &my);
+    PageView view;
+    if (page_view(sel_page, &view)) {
+        sel_end_pt = screen_to_pdf(mx, my, view.dest, view.bounds);
+        needs_redraw = true; // Trigger redraw to show the blue highlight
+    }
+}
+
 void PDFCore::render_selection(const SDL_Rect& dest, const int page_num) {
-    fz_page *page = fz_load_page(ctx, doc, page_num);
-    fz_stext_page *stext = fz_new_stext_page_from_page(ctx, page, nullptr);
+    fz_rect p_rect;
+    fz_stext_page *stext = page_cache->try_get_stext(ctx, page_num, &p_rect);
+    if (!stext) {
+        // Highlighted once a worker has extracted the text
+        request_text(page_num);
+        return;
+    }
 
     fz_quad quads[500];
     const int n = fz_highlight_selection(ctx, stext, sel_start_pt, sel_end_pt, quads, 500);
 
     SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
     SDL_SetRenderDrawColor(renderer, 0, 120, 215, 100); // Highlight color
+    draw_quads(dest, p_rect, quads, n);
+
+    fz_drop_stext_page(ctx, stext);
+}
 
-    const fz_rect p_rect = fz_bound_page(ctx, page);
-    const float pw = p_rect.x1 - p_rect.x0;
-    const float ph = p_rect.y1 - p_rect.y0;
+void PDFCore::draw_quads(const SDL_Rect &dest, const fz_rect &page_rect, const fz_quad *quads, const int n) {
+    const float pw = page_rect.x1 - page_rect.x0;
+    const float ph = page_rect.y1 - page_rect.y0;
 
     for (int i = 0; i < n; i++) {
         SDL_Rect r;
-        r.x = dest.x + (quads[i].ul.x * (dest.w / pw));
-        r.y = dest.y + (quads[i].ul.y * (dest.h / ph));
+        r.x = dest.x + ((quads[i].ul.x - page_rect.x0) * (dest.w / pw));
+        r.y = dest.y + ((quads[i].ul.y - page_rect.y0) * (dest.h / ph));
         r.w = (quads[i].ur.x - quads[i].ul.x) * (dest.w / pw);
         r.h = (quads[i].ll.y - quads[i].ul.y) * (dest.h / ph);
         SDL_RenderFillRect(renderer, &r);
     }
-
-    fz_drop_stext_page(ctx, stext);
 }
 
 void PDFCore::copy_selection_to_clipboard() {
     // 1. Safety check: make sure points aren't identical
     if (sel_start_pt.x == sel_end_pt.x && sel_start_pt.y == sel_end_pt.y) return;
 
-    // 2. Load the page and text structure
-    fz_page *page = fz_load_page(ctx, doc, static_cast<int>(current_page));
-    fz_stext_page *stext = fz_new_stext_page_from_page(ctx, page, nullptr);
+    // 2. Load the text structure; without it, copy when a worker has it
+    copy_pending = false;
+    fz_stext_page *stext = page_cache->try_get_stext(ctx, sel_page, nullptr);
+    if (!stext) {
+        copy_pending = true;
+        request_text(sel_page);
+        return;
+    }
+    copy_selection_text(stext);
+    fz_drop_stext_page(ctx, stext);
+}
 
+void PDFCore::copy_selection_text(fz_stext_page *stext) {
     // 3. Extract the text (MuPDF returns a heap-allocated UTF-8 string)
     // Note: 0 = non-copy-permit (usually ignored), 1 = crlf (Windows style)
     char *selected_text = fz_copy_selection(ctx, stext, sel_start_pt, sel_end_pt, 0);
@@ -266,6 +1451,138 @@ void PDFCore::copy_selection_to_clipboard() {
         // 5. Cleanup MuPDF allocated string
         fz_free(ctx, selected_text);
     }
+}
+void PDFCore::open_search() {
+    if (search_typing) return;
+    // Documents opened only to read never pay for the index. Off with
+    // PDFF_TEXT_INDEX=0, e.g. for documents searched only once.
+    const char *index_setting = std::getenv("PDFF_TEXT_INDEX");
+    if (!text_index && (!index_setting || std::strcmp(index_setting, "0") != 0)) {
+        text_index = std::make_unique<TextIndex>(ctx, *page_cache, *pool, page_count, text_index_path,
+            env_megabytes("PDFF_TEXT_INDEX_MB", default_text_index_mb));
+        if (!source || source->complete()) text_index->build();
+    }
+    search_typing = true;
+    SDL_StartTextInput();
+    needs_redraw = true;
+}
 
-    fz_drop_stext_page(ctx, stext);
-}
\ No newline at end of file
+void PDFCore::close_search(const bool clear) {
+    if (search_typing) {
+        search_typing = false;
+        SDL_StopTextInput();
+    } else if (clear) {
+        edit_search("");
+    }
+    needs_redraw = true;
+}
+
+void PDFCore::edit_search(const std::string &query) {
+    search_query = query;
+    search_hits.clear();
+    search_hit_count = 0;
+    hit_page = -1;
+    hit_index = 0;
+    if (!search && !query.empty()) {
+        search = std::make_unique<TextSearch>(ctx, *page_cache, *pool, page_count, [this] {
+            SDL_Event ready{};
+            ready.type = search_event;
+            SDL_PushEvent(&ready);
+        }, text_index.get());
+    }
+    if (search && query.empty()) {
+        search->cancel();
+    } else if (search) {
+        // Starting at the page being read makes the first hit the nearest one
+        search->start(query, static_cast<int>(current_page));
+    }
+    needs_redraw = true;
+}
+
+void PDFCore::handle_search_key(const SDL_Keysym &key) {
+    if (key.sym == SDLK_ESCAPE) {
+        close_search(false);
+    } else if (key.sym == SDLK_RETURN) {
+        step_hit((key.mod & KMOD_SHIFT) ? -1 : 1);
+    } else if (key.sym == SDLK_BACKSPACE && !search_query.empty()) {
+        // Drop the last UTF-8 sequence, not just its last byte
+        size_t end = search_query.size() - 1;
+        while (end > 0 && (static_cast<unsigned char>(search_query[end]) & 0xC0) == 0x80) end--;
+        edit_search(search_query.substr(0, end));
+    }
+}
+
+void PDFCore::collect_search_hits() {
+    if (!search) return;
+    std::vector<SearchHit> hits = search->take_hits();
+    const bool first_hits = search_hit_count == 0 && !hits.empty();
+    for (auto &hit : hits) {
+        search_hits[hit.page_num].push_back(std::move(hit));
+    }
+    search_hit_count += static_cast<int>(hits.size());
+    // Searching starts at the current page, so the first hit found is the
+    // next one in reading order
+    if (first_hits) {
+        const auto first = search_hits.lower_bound(static_cast<int>(current_page));
+        show_hit(first != search_hits.end() ? first->first : search_hits.begin()->first, 0);
+    }
+    // Redraw for the count in the title, and for hits on the pages shown
+    needs_redraw = true;
+}
+
+void PDFCore::step_hit(const int direction) {
+    if (search_hits.empty()) return;
+    if (hit_page < 0) {
+        const auto first = search_hits.lower_bound(static_cast<int>(current_page));
+        show_hit(first != search_hits.end() ? first->first : search_hits.begin()->first, 0);
+        return;
+    }
+    auto it = search_hits.find(hit_page);
+    const int index = hit_index + direction;
+    if (index >= 0 && index < static_cast<int>(it->second.size())) {
+        show_hit(hit_page, index);
+    } else if (direction > 0) {
+        if (++it == search_hits.end()) it = search_hits.begin();
+        show_hit(it->first, 0);
+    } else {
+        if (it == search_hits.begin()) it = search_hits.end();
+        --it;
+        show_hit(it->first, static_cast<int>(it->second.size()) - 1);
+    }
+}
+
+void PDFCore::show_hit(const int page_num, const int index) {
+    hit_page = page_num;
+    hit_index = index;
+    int first, last;
+    visible_pages(&first, &last);
+    if (page_num < first || page_num > last) go_to_page(page_num);
+
+    // A page in continuous mode can be taller than the window
+    PageView view;
+    if (continuous && page_view(page_num, &view)) {
+        const fz_quad &quad = search_hits[page_num][index].quads.front();
+        const float ph = view.bounds.y1 - view.bounds.y0;
+        const float y = static_cast<float>(view.dest.y)
+            + (quad.ul.y - view.bounds.y0) * static_cast<float>(view.dest.h) / ph;
+        int ww, wh;
+        output_size(&ww, &wh);
+        if (y < 0.0f || y >= static_cast<float>(wh)) scroll_by(y - static_cast<float>(wh) / 3.0f);
+    }
+    needs_redraw = true;
+}
+
+void PDFCore::draw_search_hits(const int page_num, const PageView &view) {
+    const auto it = search_hits.find(page_num);
+    if (it == search_hits.end()) return;
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    for (int i = 0; i < static_cast<int>(it->second.size()); i++) {
+        const std::vector<fz_quad> &quads = it->second[i].quads;
+        if (page_num == hit_page && i == hit_index) {
+            SDL_SetRenderDrawColor(renderer, 255, 120, 0, 140);
+        } else {
+            SDL_SetRenderDrawColor(renderer, 255, 210, 0, 90);
+        }
+        draw_quads(view.dest, view.bounds, quads.data(), static_cast<int>(quads.size()));
+    }
+}
@@ -1,23 +1,168 @@
 #ifndef PDFF_CORE_H
 #define PDFF_CORE_H
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <unordered_map>
 #include <SDL2/SDL.h>
 
 extern "C" {
     #include <mupdf/fitz.h>
 }
 
+#include "alloc_tracker.h"
+#include "mu_locks.h"
+#include "page_cache.h"
+#include "doc_cache.h"
+#include "mapped_stream.h"
+#include "page_layout.h"
+#include "progressive_file.h"
+#include "raster_cache.h"
+#include "render_pool.h"
+#include "texture_pool.h"
+#include "text_search.h"
+#include "thumbnail_atlas.h"
+#include "thumbnail_renderer.h"
+#include "tile_cache.h"
+
 class PDFCore {
     public:
-        void open(const std::string &file_path);
+        // `store_bytes` caps MuPDF's resource store (0 = unlimited). Nearing
+        // `memory_limit` resident bytes (0 = none) empties the store.
+        explicit PDFCore(size_t store_bytes, size_t memory_limit = 0);
+        // With `progressive` the window comes up right away and pages show
+        // as their data arrives, for files on slow storage. Otherwise the
+        // file is memory-mapped unless `mapped` is false.
+        void open(const std::string &file_path, bool progressive = false, bool mapped = true);
         int run();
+        // Bytes from environment variable `name` in MiB, else `fallback` MiB
+        static size_t env_megabytes(const char *name, size_t fallback);
     private:
+        void handle_event(const SDL_Event &event);
+        void wake_in(Uint32 ms);
         unsigned int current_page = 0;
-        Uint32 resize_timer = 0;
+        int page_count = 0;
+        // +1 when paging forward, -1 backward; decides what gets prefetched
+        int reading_direction = 1;
+        // Renderer output size and its ratio to window coordinates,
+        // refreshed by update_window_size() when the window changes
+        int output_w = 1;
+        int output_h = 1;
+        float window_scale = 1.0f;
+        // Output size seen at the last frame while a resize settles
+        int resize_w = 0;
+        int resize_h = 0;
         fz_document *doc = nullptr;
-        SDL_Window *window = SDL_CreateWindow("PDFF Reader", 100, 100, 800, 1000, SDL_WINDOW_RESIZABLE);
+        std::string file_path;
+        // Source of a progressively opened document, nullptr otherwise
+        std::unique_ptr<ProgressiveFile> source;
+        // No more data is coming: all of it is in, or reading it failed
+        bool source_complete = false;
+        // The document never opened; run() exits with an error status
+        bool open_failed = false;
+        SDL_Window *window = nullptr;
         SDL_Renderer *renderer = nullptr;
-        SDL_Texture *current_tex = nullptr;
-        fz_context *ctx = fz_new_context(nullptr, nullptr, FZ_STORE_UNLIMITED);
+        std::unique_ptr<TexturePool> textures;
+        std::unique_ptr<TileCache> tiles;
+        // Textures of tiles in flight, locked for the workers to draw into
+        std::unordered_map<unsigned char *, SDL_Texture *> locked_tiles;
+        MuLocks locks;
+        fz_context *ctx = nullptr;
+        size_t memory_limit = 0;
+        // Page and tile cache bytes when the store was last trimmed for them
+        size_t cache_bytes_seen = 0;
+        Uint32 next_memory_check = 0;
+        // Guards `doc`, which is shared with the render workers
+        std::mutex doc_mutex;
+        std::unique_ptr<PageCache> page_cache;
+        // Tiles of the preview and the default zoom, kept across sessions
+        std::unique_ptr<RasterCache> rasters;
+        std::unique_ptr<RenderPool> pool;
+        Uint32 render_event = 0;
+        Uint32 layout_event = 0;
+        Uint32 data_event = 0;
+        Uint32 thumb_event = 0;
+        Uint32 search_event = 0;
+        // Pushed by wake_timer, which is 0 when none is pending
+        Uint32 wake_event = 0;
+        SDL_TimerID wake_timer = 0;
+        Uint32 wake_at = 0;
+        // Tiles submitted to the pool and not delivered yet
+        std::set<TileKey> in_flight;
+        // Pages whose bounds a worker is loading
+        std::set<int> preparing;
+        // Pages whose text a worker is extracting for the selection
+        std::set<int> text_pending;
+        // Ctrl+C came before the selected page's text; copy when it lands
+        bool copy_pending = false;
+        // Continuous mode was asked for before page 0 was loaded
+        bool continuous_pending = false;
+        // Scale each page's visible tiles were last all there at
+        std::unordered_map<int, float> shown_scale;
+        // Tiles drawn with data missing, shown as they are and redrawn when
+        // more of a progressive file arrives
+        std::map<TileKey, RenderJob> incomplete_tiles;
+        // Pages MuPDF reported errors on while drawing
+        std::set<int> error_pages;
+        // An arrow key is held down: pages flash by, so nothing around the
+        // one on screen is prefetched until it is released
+        bool skimming = false;
+        // Progress bar fill in thousandths, -1 when hidden
+        int progress_shown = -1;
+        Uint32 progress_since = 0;
+        Uint32 next_progress_check = 0;
+        std::string title_shown;
+
+        // Render scale on top of the exact device scale
+        float supersample = 1.0f;
+        // 1 = page fits the window; pan moves the page from its centered spot
+        float zoom = 1.0f;
+        float pan_x = 0.0f;
+        float pan_y = 0.0f;
+        bool is_panning = false;
+        // Continuous mode stacks all pages; scroll_y is the document y, in
+        // points, at the top of the window
+        bool continuous = false;
+        double scroll_y = 0.0;
+        std::unique_ptr<PageLayout> layout;
+        // Thumbnail strip on the left; thumb_scroll is in output pixels
+        bool show_thumbnails = false;
+        float thumb_scroll = 0.0f;
+        std::unique_ptr<ThumbnailRenderer> thumbs;
+        std::unique_ptr<ThumbnailAtlas> atlas;
+        // Pages whose thumbnail could not be drawn; not asked for again
+        std::set<int> thumb_failed;
+        // Ctrl+F search. While typing, keys edit the query instead of
+        // driving the viewer; hits stay highlighted until Escape.
+        std::unique_ptr<TextSearch> search;
+        // Narrows searches down; kept at text_index_path across sessions
+        std::unique_ptr<TextIndex> text_index;
+        std::string text_index_path;
+        bool search_typing = false;
+        std::string search_query;
+        std::map<int, std::vector<SearchHit>> search_hits;
+        int search_hit_count = 0;
+        // The hit next/previous start from; hit_page is -1 before the first
+        int hit_page = -1;
+        int hit_index = 0;
+        // Pages in_prefetch_window() accepts, set by schedule_renders()
+        int prefetch_first = 0;
+        int prefetch_last = 0;
+
+        // Where a page goes on screen and how sharp its tiles are
+        struct PageView {
+            SDL_Rect fit{};  // page fitted to the window, before zoom
+            SDL_Rect dest{}; // after zoom and pan
+            fz_rect bounds{};
+            float scale = 0.0f;
+        };
+        // Tiles of a page needed on screen: sharp ones in [x0, x1) x [y0, y1)
+        struct TileRange {
+            int zoom = 0;
+            int preview_zoom = 0;
+            int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+        };
 
         bool is_resizing = false;
         bool running = true;
@@ -28,16 +173,77 @@ class PDFCore {
         float page_height{};
         float aspect_ratio{};
 
-        fz_stext_page *current_stext = nullptr;
         bool is_selecting = false;
+        int sel_page = 0;
         fz_point sel_start_pt = {0, 0};
         fz_point sel_end_pt = {0, 0};
+        // The mouse moved while selecting and sel_end_pt is behind
+        bool sel_moved = false;
 
-        SDL_Texture* render_page_to_texture(const int &page_num);
+        bool try_open_document();
+        void start_document();
+        void on_document_data();
+        void go_to_page(int page_num);
+        void update_window_size();
+        void output_size(int *w, int *h) const;
+        int sidebar_width() const;
+        void mouse_position(int *x, int *y) const;
+        bool page_view(int page_num, PageView *view);
+        float continuous_scale() const;
+        bool continuous_page_view(int page_num, PageView *view);
+        bool page_under(int my, int *page_num, PageView *view);
+        void visible_pages(int *first, int *last) const;
+        void set_continuous(bool enable);
+        void apply_layout_scan();
+        void scroll_by(float dy);
+        void update_current_from_scroll();
+        static float preview_scale(const fz_rect &bounds);
+        void zoom_at(float factor, int mx, int my);
+        void pan_by(float dx, float dy);
+        void clamp_pan(bool align_top = false);
+        bool visible_tiles(int page_num, TileRange *range);
+        bool in_prefetch_window(int page_num) const;
+        void update_prefetch_window();
+        void schedule_renders();
+        void prepare_page(int page_num, bool speculative);
+        bool keep_preparing(int page_num) const;
+        void request_text(int page_num);
+        void request_page(int page_num, bool speculative);
+        void request_tile(int page_num, float scale, const TileGrid &grid, int x, int y,
+                          bool speculative, bool warm_text, bool persist);
+        void collect_rendered_pages();
+        bool update_progress();
+        void draw_progress();
+        void update_title();
+        void relieve_memory_pressure(bool check_rss);
+        static size_t resident_bytes();
+        void draw_page(int page_num, const PageView &view);
+        bool draw_tiles(int page_num, const PageView &view, float scale);
+        void cancel_sharp_renders();
+        void draw_placeholder(int page_num);
+        void toggle_thumbnails();
+        void scroll_thumbnails(float dy);
+        void reveal_thumbnail(int page_num);
+        void schedule_thumbnails();
+        void collect_thumbnails();
+        void draw_thumbnails();
+        void open_search();
+        void close_search(bool clear);
+        void edit_search(const std::string &query);
+        void handle_search_key(const SDL_Keysym &key);
+        void collect_search_hits();
+        void step_hit(int direction);
+        void show_hit(int page_num, int index);
+        void draw_search_hits(int page_num, const PageView &view);
+        void draw_quads(const SDL_Rect &dest, const fz_rect &page_rect, const fz_quad *quads, int n);
+        static SDL_FRect to_frect(const SDL_Rect &rect);
+        SDL_Texture* pixmap_to_texture(fz_pixmap *pix);
         static SDL_Rect calculate_dest_rect(const int &win_w, const int &win_h, const int &tex_w, const int &tex_h);
-        fz_point screen_to_pdf(int mx, int my, const SDL_Rect& dest, fz_page* page);
+        void update_selection();
+        static fz_point screen_to_pdf(int mx, int my, const SDL_Rect& dest, const fz_rect& page_rect);
         void render_selection(const SDL_Rect& dest, int page_num);
         void copy_selection_to_clipboard();
+        void copy_selection_text(fz_stext_page *stext);
 };
 
 
@@ -0,0 +1,115 @@
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include "doc_cache.h"
+
+namespace fs = std::filesystem;
+
+static const char *accelerator_name = "accel";
+static const char *stamp_name = "stamp";
+
+// FNV-1a; only has to tell documents apart, not resist anyone
+static std::string hash_hex(const std::string &text) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (const unsigned char c : text) {
+        hash = (hash ^ c) * 1099511628211ULL;
+    }
+    char hex[17];
+    std::snprintf(hex, sizeof hex, "%016llx", hash);
+    return hex;
+}
+
+static fs::path cache_root() {
+    if (const char *xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg) return fs::path(xdg) / "pdff";
+    if (const char *home = std::getenv("HOME"); home && *home) return fs::path(home) / ".cache" / "pdff";
+    return {};
+}
+
+DocCache::DocCache(const std::string &doc_path) : doc_path(doc_path) {
+    std::error_code error;
+    const fs::path root = cache_root();
+    const fs::path absolute = fs::absolute(doc_path, error);
+    if (root.empty() || error) return;
+    const auto size = fs::file_size(absolute, error);
+    if (error) return;
+    const auto mtime = fs::last_write_time(absolute, error);
+    if (error) return;
+
+    const fs::path doc_dir = root / hash_hex(absolute.lexically_normal().string());
+    fs::create_directories(doc_dir, error);
+    if (error) return;
+    dir = doc_dir.string();
+
+    std::ostringstream stamp;
+    stamp << absolute.lexically_normal().string() << '\n' << size << '\n'
+          << mtime.time_since_epoch().count() << '\n';
+    validate(stamp.str());
+}
+
+std::string DocCache::path(const std::string &name) const {
+    if (dir.empty()) return {};
+    return (fs::path(dir) / name).string();
+}
+
+void DocCache::validate(const std::string &stamp) {
+    const std::string stamp_path = path(stamp_name);
+    std::ifstream in(stamp_path, std::ios::binary);
+    const std::string old_stamp((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (old_stamp == stamp) return;
+
+    // Made for another version of the file (or a hash collision)
+    std::error_code error;
+    for (const auto &entry : fs::directory_iterator(dir, error)) {
+        fs::remove_all(entry.path(), error);
+    }
+    std::ofstream out(stamp_path, std::ios::binary | std::ios::trunc);
+    out << stamp;
+    if (!out) dir.clear();
+}
+
+fz_document *DocCache::open_document(fz_context *ctx, const bool mapped, const MappedStream::Access access) {
+    const std::string accel = path(accelerator_name);
+    std::error_code error;
+    const bool has_accel = !accel.empty() && fs::exists(accel, error);
+
+    fz_document *doc = nullptr;
+    bool stale = false;
+    fz_var(doc);
+    fz_var(stale);
+    if (has_accel) {
+        fz_try(ctx) {
+            doc = MappedStream::open_document(ctx, doc_path, mapped, access, accel.c_str());
+        }
+        fz_catch(ctx) {
+            // Unreadable accelerator data; the plain open below redoes it
+            fz_report_error(ctx);
+            stale = true;
+        }
+    }
+    if (!doc) {
+        doc = MappedStream::open_document(ctx, doc_path, mapped, access);
+    }
+    if (stale) fs::remove(accel, error);
+    if (!accel.empty() && (!has_accel || stale)) save_accelerator(ctx, doc);
+    return doc;
+}
+
+void DocCache::save_accelerator(fz_context *ctx, fz_document *doc) {
+    if (!fz_document_supports_accelerator(ctx, doc)) return;
+    // Written aside and renamed, so another instance never reads half a file
+    const std::string accel = path(accelerator_name);
+    const std::string partial = accel + ".part";
+    bool saved = false;
+    fz_try(ctx) {
+        fz_save_accelerator(ctx, doc, partial.c_str());
+        saved = true;
+    }
+    fz_catch(ctx) {
+        fz_report_error(ctx);
+    }
+    std::error_code error;
+    if (saved) fs::rename(partial, accel, error);
+    if (!saved || error) fs::remove(partial, error);
+}
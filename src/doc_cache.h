@@ -0,0 +1,38 @@
+#ifndef PDFF_DOC_CACHE_H
+#define PDFF_DOC_CACHE_H
+#include <string>
+
+extern "C" {
+    #include <mupdf/fitz.h>
+}
+
+#include "mapped_stream.h"
+
+// On-disk cache for one document: a directory under $XDG_CACHE_HOME/pdff
+// (or ~/.cache/pdff) named after a hash of the document's absolute path.
+// A stamp file records the size and mtime the contents were made for; when
+// the document changes the directory is emptied on the next open.
+class DocCache {
+    public:
+        explicit DocCache(const std::string &doc_path);
+
+        // False when there is no cache directory to use or the document
+        // cannot be stat'ed; path() is empty then
+        bool enabled() const { return !dir.empty(); }
+        // Full path of `name` inside the document's directory
+        std::string path(const std::string &name) const;
+
+        // Open the document with its accelerator data if there is any, and
+        // save that data for next time if there is none. Throws like
+        // fz_open_document.
+        fz_document *open_document(fz_context *ctx, bool mapped, MappedStream::Access access);
+    private:
+        std::string doc_path;
+        std::string dir;
+
+        void validate(const std::string &stamp);
+        void save_accelerator(fz_context *ctx, fz_document *doc);
+};
+
+
+#endif //PDFF_DOC_CACHE_H
@@ -1,11 +1,107 @@
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include "./core.h"
+#include "./batch_render.h"
+#include "./bench.h"
+
+// Fonts and decoded images MuPDF keeps around
+static constexpr size_t default_store_mb = 256;
+
+static int usage() {
+    std::cerr << "Usage: pdff [--progressive] [--stream mmap|file] [--store-mb N] [--memory-limit-mb N] FILE\n"
+              << "       pdff --render OUT_%d.png [--dpi N] [--pages A-B] [--threads T] [--stream mmap|file]\n"
+              << "                                [--store-mb N] [--cache] FILE\n"
+              << "       pdff --bench [--reps N] [--dpi N] [--format json|csv] [--stream mmap|file] FILE\n";
+    return 1;
+}
+
+// "A-B", "A-" (to the end) or "A"
+static bool parse_pages(const char *spec, int *first, int *last) {
+    char *end = nullptr;
+    *first = static_cast<int>(std::strtol(spec, &end, 10));
+    if (end == spec || *first < 1) return false;
+    if (*end == '\0') {
+        *last = *first;
+        return true;
+    }
+    if (*end != '-') return false;
+    const char *rest = end + 1;
+    if (*rest == '\0') {
+        *last = 0;
+        return true;
+    }
+    *last = static_cast<int>(std::strtol(rest, &end, 10));
+    return end != rest && *end == '\0' && *last >= *first;
+}
 
 int main(const int argc, const char **argv) {
-    if (argc < 2) return 1;
+    BatchOptions batch;
+    BenchOptions bench;
+    bool headless = false;
+    bool benchmark = false;
+    bool progressive = false;
+    bool mapped = true;
+    // Flags win over PDFF_STORE_MB / PDFF_MEMORY_LIMIT_MB
+    size_t store_bytes = PDFCore::env_megabytes("PDFF_STORE_MB", default_store_mb);
+    size_t memory_limit = PDFCore::env_megabytes("PDFF_MEMORY_LIMIT_MB", 0);
+    std::string file_path;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (std::strcmp(arg, "--render") == 0 && has_value) {
+            headless = true;
+            batch.output = argv[++i];
+        } else if (std::strcmp(arg, "--dpi") == 0 && has_value) {
+            batch.dpi = bench.dpi = std::strtof(argv[++i], nullptr);
+            if (batch.dpi <= 0.0f) return usage();
+        } else if (std::strcmp(arg, "--pages") == 0 && has_value) {
+            if (!parse_pages(argv[++i], &batch.first_page, &batch.last_page)) return usage();
+        } else if (std::strcmp(arg, "--threads") == 0 && has_value) {
+            batch.threads = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (std::strcmp(arg, "--store-mb") == 0 && has_value) {
+            store_bytes = std::strtoull(argv[++i], nullptr, 10) * 1024 * 1024;
+        } else if (std::strcmp(arg, "--memory-limit-mb") == 0 && has_value) {
+            memory_limit = std::strtoull(argv[++i], nullptr, 10) * 1024 * 1024;
+        } else if (std::strcmp(arg, "--stream") == 0 && has_value) {
+            const std::string stream = argv[++i];
+            if (stream != "mmap" && stream != "file") return usage();
+            mapped = batch.mapped = bench.mapped = stream == "mmap";
+        } else if (std::strcmp(arg, "--cache") == 0) {
+            batch.use_cache = true;
+        } else if (std::strcmp(arg, "--progressive") == 0) {
+            progressive = true;
+        } else if (std::strcmp(arg, "--bench") == 0) {
+            benchmark = true;
+        } else if (std::strcmp(arg, "--reps") == 0 && has_value) {
+            bench.reps = static_cast<int>(std::strtol(argv[++i], nullptr, 10));
+            if (bench.reps < 1) return usage();
+        } else if (std::strcmp(arg, "--format") == 0 && has_value) {
+            const std::string format = argv[++i];
+            if (format != "json" && format != "csv") return usage();
+            bench.csv = format == "csv";
+        } else if (arg[0] == '-' && arg[1] == '-') {
+            return usage();
+        } else {
+            file_path = arg;
+        }
+    }
+    if (file_path.empty()) return usage();
+
+    if (benchmark) {
+        bench.input = file_path;
+        Benchmark runner(bench);
+        return runner.run();
+    }
+    if (headless) {
+        batch.input = file_path;
+        batch.store_bytes = store_bytes;
+        BatchRenderer renderer(batch);
+        return renderer.run();
+    }
 
-    const std::string file_path = argv[1];
-    auto core = PDFCore();
-    core.open(file_path);
+    PDFCore core(store_bytes, memory_limit);
+    core.open(file_path, progressive, mapped);
     return core.run();
-}
\ No newline at end of file
+}
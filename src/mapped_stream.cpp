@@ -0,0 +1,97 @@
+#include <algorithm>
+#include <cstdio>
+#include "mapped_stream.h"
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define PDFF_HAVE_MMAP
+#endif
+
+// Bytes handed to MuPDF per next() call; keeps rp/wp differences well
+// inside the int range MuPDF uses for some buffer arithmetic
+static constexpr size_t max_chunk = 16 * 1024 * 1024;
+// PDF readers start at the trailer, so fault it in early
+static constexpr size_t tail_prefetch = 1024 * 1024;
+
+fz_stream *MappedStream::open(fz_context *ctx, const std::string &path, const Access access) {
+#ifdef PDFF_HAVE_MMAP
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return fz_open_file(ctx, path.c_str());
+    struct stat info{};
+    void *base = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        base = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    // The mapping keeps the file alive
+    close(fd);
+    if (base == MAP_FAILED) return fz_open_file(ctx, path.c_str());
+
+    const auto size = static_cast<size_t>(info.st_size);
+    madvise(base, size, access == Access::sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+    const size_t tail = size - std::min(size, tail_prefetch);
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    madvise(static_cast<unsigned char *>(base) + tail / page * page, size - tail / page * page, MADV_WILLNEED);
+
+    auto *state = new State{static_cast<unsigned char *>(base), size};
+    // If this throws, fz_new_stream has already run drop() on state
+    fz_stream *stm = fz_new_stream(ctx, state, next, drop);
+    stm->seek = seek;
+    return stm;
+#else
+    static_cast<void>(access);
+    return fz_open_file(ctx, path.c_str());
+#endif
+}
+
+fz_document *MappedStream::open_document(fz_context *ctx, const std::string &path, const bool mapped,
+                                         const Access access, const char *accel) {
+    if (!mapped) return fz_open_accelerated_document(ctx, path.c_str(), accel);
+    fz_stream *stm = open(ctx, path, access);
+    fz_stream *accel_stm = nullptr;
+    fz_document *doc = nullptr;
+    fz_var(accel_stm);
+    fz_try(ctx) {
+        if (accel) accel_stm = fz_open_file(ctx, accel);
+        // The path doubles as the magic, so the handler is picked by extension
+        doc = fz_open_accelerated_document_with_stream(ctx, path.c_str(), stm, accel_stm);
+    }
+    fz_always(ctx) {
+        fz_drop_stream(ctx, accel_stm);
+        fz_drop_stream(ctx, stm);
+    }
+    fz_catch(ctx) {
+        fz_rethrow(ctx);
+    }
+    return doc;
+}
+
+int MappedStream::next(fz_context *, fz_stream *stm, size_t) {
+    const auto *state = static_cast<State *>(stm->state);
+    const auto pos = static_cast<size_t>(stm->pos);
+    if (pos >= state->size) return EOF;
+    const size_t end = std::min(state->size, pos + max_chunk);
+    stm->rp = state->base + pos;
+    stm->wp = state->base + end;
+    stm->pos = static_cast<int64_t>(end);
+    return *stm->rp++;
+}
+
+void MappedStream::seek(fz_context *, fz_stream *stm, int64_t offset, const int whence) {
+    const auto *state = static_cast<State *>(stm->state);
+    const auto size = static_cast<int64_t>(state->size);
+    if (whence == SEEK_END) offset += size;
+    else if (whence == SEEK_CUR) offset += stm->pos;
+    stm->pos = std::clamp<int64_t>(offset, 0, size);
+    // Nothing buffered: the next read starts at pos
+    stm->rp = stm->wp = state->base + stm->pos;
+}
+
+void MappedStream::drop(fz_context *, void *state) {
+    auto *mapped = static_cast<State *>(state);
+#ifdef PDFF_HAVE_MMAP
+    munmap(mapped->base, mapped->size);
+#endif
+    delete mapped;
+}
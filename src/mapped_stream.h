@@ -0,0 +1,36 @@
+#ifndef PDFF_MAPPED_STREAM_H
+#define PDFF_MAPPED_STREAM_H
+#include <string>
+
+extern "C" {
+    #include <mupdf/fitz.h>
+}
+
+// fz_stream over a memory-mapped file. MuPDF reads straight out of the
+// mapping, so seeking around a large document costs page faults served
+// from the OS page cache instead of read() calls and buffer copies.
+class MappedStream {
+    public:
+        // How the document will be read; passed on to madvise
+        enum class Access { random, sequential };
+
+        // New reference, drop with fz_drop_stream. Falls back to MuPDF's
+        // file stream where the file cannot be mapped.
+        static fz_stream *open(fz_context *ctx, const std::string &path, Access access);
+        // fz_open_document through open() when `mapped`, else the stock way.
+        // `accel` names a file of accelerator data to open with, or nullptr.
+        static fz_document *open_document(fz_context *ctx, const std::string &path, bool mapped, Access access,
+                                          const char *accel = nullptr);
+    private:
+        struct State {
+            unsigned char *base;
+            size_t size;
+        };
+
+        static int next(fz_context *ctx, fz_stream *stm, size_t max);
+        static void seek(fz_context *ctx, fz_stream *stm, int64_t offset, int whence);
+        static void drop(fz_context *ctx, void *state);
+};
+
+
+#endif //PDFF_MAPPED_STREAM_H
@@ -0,0 +1,30 @@
+#include <stdexcept>
+#include "mu_locks.h"
+
+MuLocks::MuLocks() {
+    for (int i = 0; i < FZ_LOCK_MAX; i++) {
+        if (mu_create_mutex(&mutexes[i]) != 0) {
+            for (int j = 0; j < i; j++) {
+                mu_destroy_mutex(&mutexes[j]);
+            }
+            throw std::runtime_error("Failed to create MuPDF lock mutex");
+        }
+    }
+    locks.user = mutexes;
+    locks.lock = lock;
+    locks.unlock = unlock;
+}
+
+MuLocks::~MuLocks() {
+    for (auto &mutex : mutexes) {
+        mu_destroy_mutex(&mutex);
+    }
+}
+
+void MuLocks::lock(void *user, const int lock) {
+    mu_lock_mutex(&static_cast<mu_mutex *>(user)[lock]);
+}
+
+void MuLocks::unlock(void *user, const int lock) {
+    mu_unlock_mutex(&static_cast<mu_mutex *>(user)[lock]);
+}
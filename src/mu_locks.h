@@ -0,0 +1,28 @@
+#ifndef PDFF_MU_LOCKS_H
+#define PDFF_MU_LOCKS_H
+
+extern "C" {
+    #include <mupdf/fitz.h>
+    #include <mupdf/helpers/mu-threads.h>
+}
+
+// Owns the FZ_LOCK_MAX mutexes MuPDF needs before a context may be cloned
+// onto other threads. Must outlive every context created with it.
+class MuLocks {
+    public:
+        MuLocks();
+        ~MuLocks();
+        MuLocks(const MuLocks &) = delete;
+        MuLocks &operator=(const MuLocks &) = delete;
+
+        const fz_locks_context *get() const { return &locks; }
+    private:
+        mu_mutex mutexes[FZ_LOCK_MAX]{};
+        fz_locks_context locks{};
+
+        static void lock(void *user, int lock);
+        static void unlock(void *user, int lock);
+};
+
+
+#endif //PDFF_MU_LOCKS_H
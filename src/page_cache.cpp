@@ -0,0 +1,263 @@
+#include <algorithm>
+#include "alloc_tracker.h"
+#include "page_cache.h"
+
+PageCache::PageCache(fz_context *ctx, fz_document *doc, std::mutex &doc_mutex, const size_t budget_bytes)
+    : ctx(ctx), doc(doc), doc_mutex(doc_mutex), budget(budget_bytes) {}
+
+PageCache::~PageCache() {
+    for (auto &[page_num, entry] : entries) {
+        fz_drop_stext_page(ctx, entry.stext);
+        fz_drop_display_list(ctx, entry.list);
+    }
+}
+
+void PageCache::report_unless_pending(fz_context *caller_ctx) {
+    // Progressively loaded pages fail like this until their data is in
+    if (fz_caught(caller_ctx) == FZ_ERROR_TRYLATER) {
+        fz_ignore_error(caller_ctx);
+    } else {
+        fz_report_error(caller_ctx);
+    }
+}
+
+size_t PageCache::used_bytes() {
+    std::lock_guard lock(cache_mutex);
+    return used;
+}
+
+fz_display_list *PageCache::get_list(fz_context *caller_ctx, const int page_num, fz_rect *bounds,
+                                     fz_cookie *cookie) {
+    {
+        std::lock_guard lock(cache_mutex);
+        if (const auto it = entries.find(page_num); it != entries.end()) {
+            lru.splice(lru.begin(), lru, it->second.lru_pos);
+            if (bounds) *bounds = it->second.bounds;
+            return fz_keep_display_list(caller_ctx, it->second.list);
+        }
+    }
+
+    // Record without holding the cache lock so hits on other pages stay cheap
+    fz_rect rect = fz_empty_rect;
+    size_t bytes = 0;
+    fz_display_list *list = record(caller_ctx, page_num, &rect, &bytes, cookie);
+    if (!list) return nullptr;
+    if (bounds) *bounds = rect;
+    // Objects still being downloaded are missing from it; good to show
+    // meanwhile, but recorded again once they are in
+    if (cookie && cookie->incomplete) return list;
+
+    std::lock_guard lock(cache_mutex);
+    if (const auto it = entries.find(page_num); it != entries.end()) {
+        // Another thread recorded the same page meanwhile; keep theirs
+        fz_drop_display_list(caller_ctx, list);
+        lru.splice(lru.begin(), lru, it->second.lru_pos);
+        return fz_keep_display_list(caller_ctx, it->second.list);
+    }
+    lru.push_front(page_num);
+    entries[page_num] = {fz_keep_display_list(caller_ctx, list), nullptr, rect, bytes, lru.begin()};
+    page_bounds[page_num] = rect;
+    used += bytes;
+    evict_over_budget(caller_ctx, page_num);
+    return list;
+}
+
+fz_display_list *PageCache::get_list_transient(fz_context *caller_ctx, const int page_num, fz_rect *bounds,
+                                               fz_cookie *cookie) {
+    {
+        std::lock_guard lock(cache_mutex);
+        if (const auto it = entries.find(page_num); it != entries.end()) {
+            if (bounds) *bounds = it->second.bounds;
+            return fz_keep_display_list(caller_ctx, it->second.list);
+        }
+    }
+    fz_rect rect = fz_empty_rect;
+    size_t bytes = 0;
+    fz_display_list *list = record(caller_ctx, page_num, &rect, &bytes, cookie);
+    if (list && bounds) *bounds = rect;
+    return list;
+}
+
+fz_stext_page *PageCache::try_get_stext(fz_context *caller_ctx, const int page_num, fz_rect *bounds) {
+    std::lock_guard lock(cache_mutex);
+    if (const auto it = entries.find(page_num); it != entries.end() && it->second.stext) {
+        lru.splice(lru.begin(), lru, it->second.lru_pos);
+        if (bounds) *bounds = it->second.bounds;
+        return fz_keep_stext_page(caller_ctx, it->second.stext);
+    }
+    return nullptr;
+}
+
+fz_stext_page *PageCache::get_stext(fz_context *caller_ctx, const int page_num, fz_rect *bounds) {
+    if (fz_stext_page *cached = try_get_stext(caller_ctx, page_num, bounds)) return cached;
+
+    fz_display_list *list = get_list(caller_ctx, page_num, bounds);
+    if (!list) return nullptr;
+
+    fz_stext_page *stext = nullptr;
+    const AllocScope scope(AllocCategory::text);
+    const long long before = AllocTracker::thread_net_bytes();
+    fz_var(stext);
+    fz_try(caller_ctx) {
+        stext = fz_new_stext_page_from_display_list(caller_ctx, list, nullptr);
+    }
+    fz_always(caller_ctx) {
+        fz_drop_display_list(caller_ctx, list);
+    }
+    fz_catch(caller_ctx) {
+        fz_report_error(caller_ctx);
+        return nullptr;
+    }
+    const size_t bytes = static_cast<size_t>(std::max(0LL, AllocTracker::thread_net_bytes() - before));
+
+    std::lock_guard lock(cache_mutex);
+    const auto it = entries.find(page_num);
+    if (it == entries.end()) {
+        // Evicted while we were extracting; hand it out uncached
+        return stext;
+    }
+    if (it->second.stext) {
+        fz_drop_stext_page(caller_ctx, stext);
+        return fz_keep_stext_page(caller_ctx, it->second.stext);
+    }
+    it->second.stext = fz_keep_stext_page(caller_ctx, stext);
+    it->second.bytes += bytes;
+    used += bytes;
+    evict_over_budget(caller_ctx, page_num);
+    return stext;
+}
+
+fz_stext_page *PageCache::get_stext_transient(fz_context *caller_ctx, const int page_num, fz_rect *bounds,
+                                              fz_cookie *cookie) {
+    {
+        std::lock_guard lock(cache_mutex);
+        if (const auto it = entries.find(page_num); it != entries.end() && it->second.stext) {
+            if (bounds) *bounds = it->second.bounds;
+            return fz_keep_stext_page(caller_ctx, it->second.stext);
+        }
+    }
+
+    fz_display_list *list = get_list_transient(caller_ctx, page_num, bounds, cookie);
+    if (!list) return nullptr;
+
+    fz_stext_page *stext = nullptr;
+    const AllocScope scope(AllocCategory::text);
+    fz_var(stext);
+    fz_try(caller_ctx) {
+        stext = fz_new_stext_page_from_display_list(caller_ctx, list, nullptr);
+    }
+    fz_always(caller_ctx) {
+        fz_drop_display_list(caller_ctx, list);
+    }
+    fz_catch(caller_ctx) {
+        fz_report_error(caller_ctx);
+        return nullptr;
+    }
+    return stext;
+}
+
+bool PageCache::get_bounds(fz_context *caller_ctx, const int page_num, fz_rect *bounds) {
+    {
+        std::lock_guard lock(cache_mutex);
+        if (const auto it = page_bounds.find(page_num); it != page_bounds.end()) {
+            *bounds = it->second;
+            return true;
+        }
+    }
+    std::lock_guard lock(doc_mutex);
+    return load_bounds(caller_ctx, page_num, bounds);
+}
+
+bool PageCache::try_get_bounds(fz_context *caller_ctx, const int page_num, fz_rect *bounds) {
+    {
+        std::lock_guard lock(cache_mutex);
+        if (const auto it = page_bounds.find(page_num); it != page_bounds.end()) {
+            *bounds = it->second;
+            return true;
+        }
+    }
+    std::unique_lock lock(doc_mutex, std::try_to_lock);
+    return lock.owns_lock() && load_bounds(caller_ctx, page_num, bounds);
+}
+
+bool PageCache::load_bounds(fz_context *caller_ctx, const int page_num, fz_rect *bounds) {
+    // Caller holds doc_mutex
+    const AllocScope scope(AllocCategory::document);
+    fz_page *page = nullptr;
+    fz_rect rect = fz_empty_rect;
+    bool ok = true;
+    fz_var(page);
+    fz_try(caller_ctx) {
+        page = fz_load_page(caller_ctx, doc, page_num);
+        rect = fz_bound_page(caller_ctx, page);
+    }
+    fz_always(caller_ctx) {
+        fz_drop_page(caller_ctx, page);
+    }
+    fz_catch(caller_ctx) {
+        report_unless_pending(caller_ctx);
+        ok = false;
+    }
+    if (!ok) return false;
+
+    std::lock_guard lock(cache_mutex);
+    page_bounds[page_num] = rect;
+    *bounds = rect;
+    return true;
+}
+
+fz_display_list *PageCache::record(fz_context *caller_ctx, const int page_num, fz_rect *bounds, size_t *bytes,
+                                   fz_cookie *cookie) {
+    fz_page *page = nullptr;
+    fz_device *dev = nullptr;
+    fz_display_list *list = nullptr;
+
+    std::lock_guard lock(doc_mutex);
+    const AllocScope scope(AllocCategory::document);
+    const long long before = AllocTracker::thread_net_bytes();
+    fz_var(page);
+    fz_var(dev);
+    fz_var(list);
+    fz_try(caller_ctx) {
+        page = fz_load_page(caller_ctx, doc, page_num);
+        *bounds = fz_bound_page(caller_ctx, page);
+        {
+            // Publish the bounds now so the event thread can lay the page
+            // out while the (possibly slow) recording is still running
+            std::lock_guard bounds_lock(cache_mutex);
+            page_bounds[page_num] = *bounds;
+        }
+        list = fz_new_display_list(caller_ctx, *bounds);
+        dev = fz_new_list_device(caller_ctx, list);
+        fz_run_page(caller_ctx, page, dev, fz_identity, cookie);
+        fz_close_device(caller_ctx, dev);
+        if (cookie && cookie->abort) {
+            // A partial list would render as a partial page forever
+            fz_drop_display_list(caller_ctx, list);
+            list = nullptr;
+        }
+    }
+    fz_always(caller_ctx) {
+        fz_drop_device(caller_ctx, dev);
+        fz_drop_page(caller_ctx, page);
+    }
+    fz_catch(caller_ctx) {
+        fz_drop_display_list(caller_ctx, list);
+        list = nullptr;
+        report_unless_pending(caller_ctx);
+    }
+    // What the list (and the resources only it holds on to) costs us
+    *bytes = static_cast<size_t>(std::max(0LL, AllocTracker::thread_net_bytes() - before));
+    return list;
+}
+
+void PageCache::evict_over_budget(fz_context *caller_ctx, const int keep_page) {
+    while (used > budget && !lru.empty() && lru.back() != keep_page) {
+        const auto it = entries.find(lru.back());
+        used -= it->second.bytes;
+        fz_drop_stext_page(caller_ctx, it->second.stext);
+        fz_drop_display_list(caller_ctx, it->second.list);
+        entries.erase(it);
+        lru.pop_back();
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef PDFF_PAGE_CACHE_H
+#define PDFF_PAGE_CACHE_H
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+extern "C" {
+    #include <mupdf/fitz.h>
+}
+
+// Display lists of visited pages, so re-rendering a page at a new size (or
+// extracting its text) replays the list instead of interpreting the content
+// stream again. The structured text of a page is built from its list on
+// first use and shared by selection, copy and search. Least recently used
+// pages are dropped once lists and text exceed `budget_bytes`. Safe to use
+// from any thread, each with its own fz_context.
+class PageCache {
+    public:
+        PageCache(fz_context *ctx, fz_document *doc, std::mutex &doc_mutex, size_t budget_bytes);
+        ~PageCache();
+        PageCache(const PageCache &) = delete;
+        PageCache &operator=(const PageCache &) = delete;
+
+        // Returns a new reference (drop it with fz_drop_display_list) or
+        // nullptr if the page cannot be loaded. `bounds` receives the page
+        // rectangle. A recording aborted through `cookie` is not cached,
+        // one that `cookie` marks incomplete is handed out uncached.
+        fz_display_list *get_list(fz_context *caller_ctx, int page_num, fz_rect *bounds,
+                                  fz_cookie *cookie = nullptr);
+        // get_list that does not cache what it records, for one-off uses
+        // (thumbnails) that must not push out the pages being read
+        fz_display_list *get_list_transient(fz_context *caller_ctx, int page_num, fz_rect *bounds,
+                                            fz_cookie *cookie = nullptr);
+        // Same contract as get_list; drop with fz_drop_stext_page
+        fz_stext_page *get_stext(fz_context *caller_ctx, int page_num, fz_rect *bounds);
+        // get_stext for the event thread: nullptr unless the text is
+        // already cached, instead of interpreting the page
+        fz_stext_page *try_get_stext(fz_context *caller_ctx, int page_num, fz_rect *bounds);
+        // get_stext that leaves the caches alone unless the text is already
+        // there, for scanning every page of the document
+        fz_stext_page *get_stext_transient(fz_context *caller_ctx, int page_num, fz_rect *bounds,
+                                           fz_cookie *cookie = nullptr);
+        // Page rectangle, remembered even after the page's list is evicted
+        bool get_bounds(fz_context *caller_ctx, int page_num, fz_rect *bounds);
+        // get_bounds for the event thread: gives up instead of waiting while
+        // a worker holds the document
+        bool try_get_bounds(fz_context *caller_ctx, int page_num, fz_rect *bounds);
+
+        size_t used_bytes();
+    private:
+        struct Entry {
+            fz_display_list *list = nullptr;
+            fz_stext_page *stext = nullptr;
+            fz_rect bounds{};
+            size_t bytes = 0;
+            std::list<int>::iterator lru_pos;
+        };
+
+        fz_context *ctx;
+        fz_document *doc;
+        std::mutex &doc_mutex;
+        const size_t budget;
+
+        std::mutex cache_mutex;
+        std::unordered_map<int, Entry> entries;
+        std::list<int> lru; // front = most recently used
+        std::unordered_map<int, fz_rect> page_bounds;
+        size_t used = 0;
+
+        bool load_bounds(fz_context *caller_ctx, int page_num, fz_rect *bounds);
+        fz_display_list *record(fz_context *caller_ctx, int page_num, fz_rect *bounds, size_t *bytes,
+                                fz_cookie *cookie);
+        static void report_unless_pending(fz_context *caller_ctx);
+        void evict_over_budget(fz_context *caller_ctx, int keep_page);
+};
+
+
+#endif //PDFF_PAGE_CACHE_H
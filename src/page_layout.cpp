@@ -0,0 +1,87 @@
+#include <algorithm>
+#include "page_layout.h"
+
+// Pages handed over per batch; small enough for the first screens to fill
+// in quickly, large enough not to rebuild the table for every page
+static constexpr int scan_batch = 128;
+
+PageLayout::PageLayout(const int page_count, const fz_rect &first_bounds)
+    : rects(std::max(page_count, 0), first_bounds), is_known(std::max(page_count, 0), false),
+      offsets(std::max(page_count, 0) + 1, 0.0), ref_width(first_bounds.x1 - first_bounds.x0) {
+    if (page_count > 0) is_known[0] = true;
+    rebuild();
+}
+
+PageLayout::~PageLayout() {
+    stop_scan = true;
+    if (scanner.joinable()) scanner.join();
+}
+
+void PageLayout::start_scan(fz_context *ctx, PageCache &pages, std::function<void()> on_progress) {
+    if (scanner.joinable()) return;
+    fz_context *scan_ctx = fz_clone_context(ctx);
+    if (!scan_ctx) return; // pages keep their estimated size until visited
+    scanner = std::thread([this, scan_ctx, &pages, on_progress = std::move(on_progress)] {
+        scan(scan_ctx, pages, on_progress);
+        fz_drop_context(scan_ctx);
+    });
+}
+
+void PageLayout::scan(fz_context *scan_ctx, PageCache &pages, const std::function<void()> &on_progress) {
+    std::vector<std::pair<int, fz_rect>> batch;
+    for (int i = 0; i < page_count() && !stop_scan; i++) {
+        // get_bounds takes the document lock per page, so renders of the
+        // pages on screen slot in between
+        fz_rect rect;
+        if (pages.get_bounds(scan_ctx, i, &rect)) batch.emplace_back(i, rect);
+
+        if (static_cast<int>(batch.size()) >= scan_batch || i == page_count() - 1) {
+            {
+                std::lock_guard lock(scan_mutex);
+                scanned.insert(scanned.end(), batch.begin(), batch.end());
+            }
+            batch.clear();
+            if (on_progress) on_progress();
+        }
+    }
+}
+
+bool PageLayout::apply_scanned() {
+    std::vector<std::pair<int, fz_rect>> found;
+    {
+        std::lock_guard lock(scan_mutex);
+        found.swap(scanned);
+    }
+    bool moved = false;
+    for (const auto &[page_num, rect] : found) {
+        // Only heights move the pages below
+        moved |= rects[page_num].y1 - rects[page_num].y0 != rect.y1 - rect.y0;
+        rects[page_num] = rect;
+        is_known[page_num] = true;
+    }
+    if (moved) rebuild();
+    return !found.empty();
+}
+
+void PageLayout::set_bounds(const int page_num, const fz_rect &bounds) {
+    if (page_num < 0 || page_num >= page_count()) return;
+    rects[page_num] = bounds;
+    is_known[page_num] = true;
+    rebuild();
+}
+
+int PageLayout::page_at(const double y) const {
+    if (rects.empty()) return 0;
+    const auto it = std::upper_bound(offsets.begin(), offsets.end() - 1, y);
+    return std::clamp(static_cast<int>(it - offsets.begin()) - 1, 0, page_count() - 1);
+}
+
+void PageLayout::rebuild() {
+    double y = 0.0;
+    for (size_t i = 0; i < rects.size(); i++) {
+        offsets[i] = y;
+        y += rects[i].y1 - rects[i].y0;
+        if (i + 1 < rects.size()) y += gap;
+    }
+    offsets[rects.size()] = y;
+}
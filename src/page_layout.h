@@ -0,0 +1,62 @@
+#ifndef PDFF_PAGE_LAYOUT_H
+#define PDFF_PAGE_LAYOUT_H
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+extern "C" {
+    #include <mupdf/fitz.h>
+}
+
+#include "page_cache.h"
+
+// Vertical stack of all pages for continuous scrolling, in PDF points.
+// Pages whose bounds are not known yet take the size of the first page;
+// a background scan loads the real bounds and the table is rebuilt as
+// they come in. Lookups from a scroll offset to a page are O(log n).
+// Only the thread that created it may call anything but the scan itself.
+class PageLayout {
+    public:
+        static constexpr float gap = 10.0f;
+
+        PageLayout(int page_count, const fz_rect &first_bounds);
+        ~PageLayout();
+        PageLayout(const PageLayout &) = delete;
+        PageLayout &operator=(const PageLayout &) = delete;
+
+        // Loads every page's bounds on a clone of `ctx`; `on_progress` is
+        // called (from the scan thread) whenever a batch is ready
+        void start_scan(fz_context *ctx, PageCache &pages, std::function<void()> on_progress);
+        // Takes in what the scan found so far; true if any page changed
+        bool apply_scanned();
+        void set_bounds(int page_num, const fz_rect &bounds);
+
+        int page_count() const { return static_cast<int>(rects.size()); }
+        bool known(const int page_num) const { return is_known[page_num]; }
+        const fz_rect &bounds(const int page_num) const { return rects[page_num]; }
+        double offset(const int page_num) const { return offsets[page_num]; }
+        double total_height() const { return offsets.back(); }
+        float reference_width() const { return ref_width; }
+        // Page covering layout position `y` (the page above, inside a gap)
+        int page_at(double y) const;
+    private:
+        std::vector<fz_rect> rects;
+        std::vector<bool> is_known;
+        // offsets[i] = top of page i; offsets[n] = end of the last page
+        std::vector<double> offsets;
+        float ref_width;
+
+        std::thread scanner;
+        std::atomic<bool> stop_scan{false};
+        std::mutex scan_mutex;
+        std::vector<std::pair<int, fz_rect>> scanned;
+
+        void rebuild();
+        void scan(fz_context *scan_ctx, PageCache &pages, const std::function<void()> &on_progress);
+};
+
+
+#endif //PDFF_PAGE_LAYOUT_H
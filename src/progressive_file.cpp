@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+#include "progressive_file.h"
+
+// Unit of fetching and of what a stream reads at once
+static constexpr int64_t block_size = 64 * 1024;
+// Readers are woken at most this often while data trickles in
+static constexpr auto notify_interval = std::chrono::milliseconds(100);
+
+ProgressiveFile::ProgressiveFile(const std::string &path, std::function<void()> on_data,
+                                 const unsigned int throttle_kbps)
+    : path(path), on_data(std::move(on_data)), throttle_kbps(throttle_kbps) {
+    std::ifstream probe(path, std::ios::binary | std::ios::ate);
+    if (!probe) throw std::runtime_error("Cannot open " + path);
+    size = static_cast<int64_t>(probe.tellg());
+    const int64_t blocks = (size + block_size - 1) / block_size;
+    have.assign(static_cast<size_t>(blocks), false);
+    missing = blocks;
+    fetcher = std::thread(&ProgressiveFile::fetch_main, this);
+}
+
+ProgressiveFile::~ProgressiveFile() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    wanted_cv.notify_all();
+    fetcher.join();
+}
+
+bool ProgressiveFile::has_block(const int64_t block) {
+    std::lock_guard lock(mutex);
+    return have[static_cast<size_t>(block)];
+}
+
+void ProgressiveFile::request_block(const int64_t block) {
+    {
+        std::lock_guard lock(mutex);
+        wanted.erase(std::remove(wanted.begin(), wanted.end(), block), wanted.end());
+        wanted.push_front(block);
+    }
+    wanted_cv.notify_one();
+}
+
+void ProgressiveFile::fetch_main() {
+    using Clock = std::chrono::steady_clock;
+    std::ifstream in(path, std::ios::binary);
+    std::vector<char> scratch(block_size);
+    int64_t cursor = 0;
+    Clock::time_point last_notify = Clock::now();
+    const Clock::time_point start = Clock::now();
+    int64_t fetched = 0;
+
+    for (;;) {
+        int64_t block = -1;
+        bool requested = false;
+        {
+            std::unique_lock lock(mutex);
+            if (stopping || missing == 0) break;
+            // Blocks someone is waiting for first, then on in file order
+            while (!wanted.empty() && block < 0) {
+                if (!have[static_cast<size_t>(wanted.front())]) {
+                    block = wanted.front();
+                    requested = true;
+                }
+                wanted.pop_front();
+            }
+            while (block < 0) {
+                if (!have[static_cast<size_t>(cursor)]) block = cursor;
+                cursor = (cursor + 1) % static_cast<int64_t>(have.size());
+            }
+        }
+
+        // Reading is all it takes to have the OS cache the block; streams
+        // read it again from there
+        const int64_t offset = block * block_size;
+        const auto length = static_cast<std::streamsize>(std::min(block_size, size - offset));
+        in.clear();
+        in.seekg(offset);
+        in.read(scratch.data(), length);
+        if (in.gcount() != length) {
+            // The file shrank or went away; the rest is not coming
+            read_failed = true;
+            if (on_data) on_data();
+            break;
+        }
+
+        if (throttle_kbps > 0) {
+            fetched += length;
+            const auto due = start + std::chrono::milliseconds(fetched / static_cast<int64_t>(throttle_kbps));
+            std::this_thread::sleep_until(due);
+        }
+
+        {
+            std::lock_guard lock(mutex);
+            have[static_cast<size_t>(block)] = true;
+        }
+        --missing;
+        if (requested || missing == 0 || Clock::now() - last_notify >= notify_interval) {
+            last_notify = Clock::now();
+            if (on_data) on_data();
+        }
+    }
+}
+
+fz_stream *ProgressiveFile::open_stream(fz_context *ctx) {
+    auto *state = new StreamState{this, std::ifstream(path, std::ios::binary), std::vector<unsigned char>(block_size)};
+    if (!state->in) {
+        delete state;
+        fz_throw(ctx, FZ_ERROR_SYSTEM, "cannot open %s", path.c_str());
+    }
+    // If this throws, fz_new_stream has already run drop() on state
+    fz_stream *stm = fz_new_stream(ctx, state, next, drop);
+    stm->seek = seek;
+    stm->progressive = 1;
+    return stm;
+}
+
+int ProgressiveFile::next(fz_context *ctx, fz_stream *stm, size_t) {
+    auto *state = static_cast<StreamState *>(stm->state);
+    ProgressiveFile *file = state->file;
+    if (stm->pos >= file->size) return EOF;
+
+    const int64_t block = stm->pos / block_size;
+    if (!file->has_block(block)) {
+        if (file->failed()) fz_throw(ctx, FZ_ERROR_SYSTEM, "read error in %s", file->path.c_str());
+        file->request_block(block);
+        fz_throw(ctx, FZ_ERROR_TRYLATER, "waiting for data at offset %lld", static_cast<long long>(stm->pos));
+    }
+
+    const int64_t end = std::min((block + 1) * block_size, file->size);
+    const auto length = static_cast<std::streamsize>(end - stm->pos);
+    state->in.clear();
+    state->in.seekg(stm->pos);
+    state->in.read(reinterpret_cast<char *>(state->buffer.data()), length);
+    const std::streamsize got = state->in.gcount();
+    if (got <= 0) fz_throw(ctx, FZ_ERROR_SYSTEM, "read error in %s", file->path.c_str());
+
+    stm->rp = state->buffer.data();
+    stm->wp = stm->rp + got;
+    stm->pos += got;
+    return *stm->rp++;
+}
+
+void ProgressiveFile::seek(fz_context *, fz_stream *stm, int64_t offset, const int whence) {
+    auto *state = static_cast<StreamState *>(stm->state);
+    if (whence == SEEK_END) offset += state->file->size;
+    else if (whence == SEEK_CUR) offset += stm->pos;
+    stm->pos = std::clamp<int64_t>(offset, 0, state->file->size);
+    stm->rp = stm->wp = state->buffer.data();
+}
+
+void ProgressiveFile::drop(fz_context *, void *state) {
+    delete static_cast<StreamState *>(state);
+}
@@ -0,0 +1,72 @@
+#ifndef PDFF_PROGRESSIVE_FILE_H
+#define PDFF_PROGRESSIVE_FILE_H
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+    #include <mupdf/fitz.h>
+}
+
+// A file that arrives block by block, for opening documents on slow
+// storage without waiting for all of it. A fetch thread pulls blocks in
+// order, jumping ahead to any block a reader asked for; streams from
+// open_stream() are in MuPDF's progressive mode and throw FZ_ERROR_TRYLATER
+// for bytes that have not arrived yet. `on_data` runs on the fetch thread
+// whenever enough new data is there to be worth another try, and once more
+// if reading fails, after which failed() is true and streams throw
+// FZ_ERROR_SYSTEM for what is still missing.
+//
+// `throttle_kbps` > 0 limits the fetch rate, to try progressive loading
+// on a local disk.
+class ProgressiveFile {
+    public:
+        ProgressiveFile(const std::string &path, std::function<void()> on_data, unsigned int throttle_kbps = 0);
+        ~ProgressiveFile();
+        ProgressiveFile(const ProgressiveFile &) = delete;
+        ProgressiveFile &operator=(const ProgressiveFile &) = delete;
+
+        // New reference, drop with fz_drop_stream. The file must outlive it.
+        fz_stream *open_stream(fz_context *ctx);
+        bool complete() const { return missing == 0; }
+        bool failed() const { return read_failed; }
+        int64_t length() const { return size; }
+    private:
+        struct StreamState {
+            ProgressiveFile *file;
+            std::ifstream in;
+            std::vector<unsigned char> buffer;
+        };
+
+        std::string path;
+        std::function<void()> on_data;
+        unsigned int throttle_kbps;
+        int64_t size = 0;
+
+        std::mutex mutex;
+        std::condition_variable wanted_cv;
+        std::vector<bool> have;
+        std::deque<int64_t> wanted; // most recent request first
+        std::atomic<int64_t> missing{0};
+        std::atomic<bool> read_failed{false};
+        bool stopping = false;
+        std::thread fetcher;
+
+        bool has_block(int64_t block);
+        void request_block(int64_t block);
+        void fetch_main();
+
+        static int next(fz_context *ctx, fz_stream *stm, size_t max);
+        static void seek(fz_context *ctx, fz_stream *stm, int64_t offset, int whence);
+        static void drop(fz_context *ctx, void *state);
+};
+
+
+#endif //PDFF_PROGRESSIVE_FILE_H
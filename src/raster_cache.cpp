@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <filesystem>
+#include <thread>
+#include <vector>
+#include "raster_cache.h"
+
+namespace fs = std::filesystem;
+
+// Describes what RenderPool::rasterize draws; change it whenever that does
+static const char *render_options = "rgb-aa8";
+
+RasterCache::RasterCache(const std::string &dir, const size_t budget_bytes) : dir(dir), budget(budget_bytes) {
+    std::error_code error;
+    fs::create_directories(dir, error);
+
+    // Oldest files first, so last_use carries the order over from the last session
+    std::vector<std::pair<fs::file_time_type, fs::directory_entry>> found;
+    for (const auto &entry : fs::directory_iterator(dir, error)) {
+        if (entry.path().extension() != ".png") continue;
+        found.emplace_back(entry.last_write_time(error), entry);
+    }
+    std::sort(found.begin(), found.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+    for (const auto &[mtime, entry] : found) {
+        const auto bytes = static_cast<size_t>(entry.file_size(error));
+        files[entry.path().filename().string()] = {bytes, ++clock};
+        used += bytes;
+    }
+    std::lock_guard lock(mutex);
+    evict_over_budget();
+}
+
+std::string RasterCache::file_name(const TileKey &key) {
+    return std::to_string(key.page_num) + "-" + std::to_string(key.zoom) + "-" + std::to_string(key.x) + "-"
+         + std::to_string(key.y) + "-" + render_options + ".png";
+}
+
+fz_pixmap *RasterCache::load(fz_context *caller_ctx, const TileKey &key) {
+    const std::string name = file_name(key);
+    {
+        std::lock_guard lock(mutex);
+        const auto it = files.find(name);
+        if (it == files.end()) return nullptr;
+        it->second.last_use = ++clock;
+    }
+    const std::string path = (fs::path(dir) / name).string();
+    std::error_code error;
+    fs::last_write_time(path, fs::file_time_type::clock::now(), error);
+
+    fz_image *image = nullptr;
+    fz_pixmap *pix = nullptr;
+    fz_var(image);
+    fz_var(pix);
+    fz_try(caller_ctx) {
+        image = fz_new_image_from_file(caller_ctx, path.c_str());
+        pix = fz_get_pixmap_from_image(caller_ctx, image, nullptr, nullptr, nullptr, nullptr);
+        // Tiles are plain RGB; anything else is not one of ours
+        if (pix->n != 3 || pix->alpha) fz_throw(caller_ctx, FZ_ERROR_FORMAT, "unexpected pixel format");
+    }
+    fz_always(caller_ctx) {
+        fz_drop_image(caller_ctx, image);
+    }
+    fz_catch(caller_ctx) {
+        fz_drop_pixmap(caller_ctx, pix);
+        pix = nullptr;
+        fz_report_error(caller_ctx);
+    }
+    if (!pix) {
+        // Unreadable; render it again and overwrite
+        std::lock_guard lock(mutex);
+        if (const auto it = files.find(name); it != files.end()) {
+            used -= it->second.bytes;
+            files.erase(it);
+        }
+        fs::remove(path, error);
+    }
+    return pix;
+}
+
+void RasterCache::store(fz_context *caller_ctx, const TileKey &key, fz_pixmap *pix) {
+    const std::string name = file_name(key);
+    const std::string path = (fs::path(dir) / name).string();
+    // Private name first, so readers only ever see complete files
+    const std::string partial = path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+
+    // Tiles drawn as BGR or with an alpha byte for the GPU are stored as
+    // plain RGB, which is what load() hands out
+    const bool plain = pix->n == 3 && !pix->alpha && fz_colorspace_is_rgb(caller_ctx, pix->colorspace);
+    fz_pixmap *rgb = nullptr;
+    bool saved = false;
+    fz_var(rgb);
+    fz_try(caller_ctx) {
+        if (!plain) {
+            rgb = fz_convert_pixmap(caller_ctx, pix, fz_device_rgb(caller_ctx), nullptr, nullptr,
+                                    fz_default_color_params, 0);
+        }
+        fz_save_pixmap_as_png(caller_ctx, plain ? pix : rgb, partial.c_str());
+        saved = true;
+    }
+    fz_always(caller_ctx) {
+        fz_drop_pixmap(caller_ctx, rgb);
+    }
+    fz_catch(caller_ctx) {
+        fz_report_error(caller_ctx);
+    }
+    std::error_code error;
+    if (saved) fs::rename(partial, path, error);
+    if (!saved || error) {
+        fs::remove(partial, error);
+        return;
+    }
+
+    const auto bytes = static_cast<size_t>(fs::file_size(path, error));
+    std::lock_guard lock(mutex);
+    File &file = files[name];
+    used = used - file.bytes + bytes;
+    file = {bytes, ++clock};
+    evict_over_budget();
+}
+
+void RasterCache::evict_over_budget() {
+    std::error_code error;
+    while (used > budget && !files.empty()) {
+        const auto oldest = std::min_element(files.begin(), files.end(), [](const auto &a, const auto &b) {
+            return a.second.last_use < b.second.last_use;
+        });
+        fs::remove(fs::path(dir) / oldest->first, error);
+        used -= oldest->second.bytes;
+        files.erase(oldest);
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef PDFF_RASTER_CACHE_H
+#define PDFF_RASTER_CACHE_H
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+extern "C" {
+    #include <mupdf/fitz.h>
+}
+
+#include "tile_grid.h"
+
+// Rendered tiles kept on disk as PNG in a document's cache directory, so a
+// reopened document (or a page whose tiles were evicted from memory) shows
+// up at decode cost instead of render cost. File names carry the tile key
+// and a tag for the render options, so a change in how tiles are drawn
+// misses instead of showing stale pixels. The least recently used files go
+// once the directory holds more than `budget_bytes`. Safe to use from any
+// thread, each with its own fz_context.
+class RasterCache {
+    public:
+        RasterCache(const std::string &dir, size_t budget_bytes);
+
+        // New pixmap, or nullptr if the tile is not on disk
+        fz_pixmap *load(fz_context *caller_ctx, const TileKey &key);
+        // `pix` may be in the texture's layout; it is saved as plain RGB
+        void store(fz_context *caller_ctx, const TileKey &key, fz_pixmap *pix);
+    private:
+        struct File {
+            size_t bytes = 0;
+            unsigned long long last_use = 0;
+        };
+
+        std::string dir;
+        const size_t budget;
+        std::mutex mutex;
+        std::unordered_map<std::string, File> files;
+        size_t used = 0;
+        unsigned long long clock = 0;
+
+        static std::string file_name(const TileKey &key);
+        void evict_over_budget();
+};
+
+
+#endif //PDFF_RASTER_CACHE_H
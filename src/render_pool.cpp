@@ -0,0 +1,304 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include "alloc_tracker.h"
+#include "render_pool.h"
+
+RenderPool::RenderPool(fz_context *ctx, PageCache &pages, const unsigned int threads, std::function<void()> on_ready,
+                       RasterCache *rasters)
+    : ctx(ctx), pages(pages), on_ready(std::move(on_ready)), rasters(rasters) {
+    for (unsigned int i = 0; i < std::max(1u, threads); i++) {
+        // Clone on this thread: fz_clone_context needs the parent to be idle
+        fz_context *worker_ctx = fz_clone_context(ctx);
+        if (!worker_ctx) {
+            if (workers.empty()) throw std::runtime_error("Cannot clone MuPDF context");
+            break;
+        }
+        workers.emplace_back(&RenderPool::worker_main, this, worker_ctx);
+    }
+}
+
+RenderPool::~RenderPool() {
+    {
+        std::lock_guard lock(queue_mutex);
+        stopping = true;
+        pending.clear();
+    }
+    queue_cv.notify_all();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    for (auto &result : finished) {
+        fz_drop_pixmap(ctx, result.pix);
+        fz_drop_stext_page(ctx, result.stext);
+    }
+}
+
+unsigned int RenderPool::default_thread_count() {
+    // Leave one core to the event thread
+    const unsigned int cores = std::thread::hardware_concurrency();
+    return std::clamp(cores > 1 ? cores - 1 : 1u, 1u, 4u);
+}
+
+bool RenderPool::busy() {
+    std::lock_guard lock(queue_mutex);
+    return !pending.empty() || !running.empty();
+}
+
+RenderProgress RenderPool::progress() {
+    std::lock_guard lock(queue_mutex);
+    RenderProgress total;
+    for (const auto &active : running) {
+        if (active.job.speculative || active.cookie.abort) continue;
+        total.jobs++;
+        // Workers write the cookie unsynchronized; a stale value only
+        // makes the indicator lag a little
+        const size_t max = active.cookie.progress_max;
+        if (max == static_cast<size_t>(-1) || max == 0) continue;
+        total.done += std::min(static_cast<size_t>(std::max(active.cookie.progress, 0)), max);
+        total.total += max;
+    }
+    return total;
+}
+
+void RenderPool::submit(const RenderJob &job) {
+    {
+        std::lock_guard lock(queue_mutex);
+        if (job.speculative) {
+            pending.push_back(job);
+        } else {
+            const auto first_speculative = std::find_if(pending.begin(), pending.end(),
+                [](const RenderJob &queued) { return queued.speculative; });
+            pending.insert(first_speculative, job);
+            preempt_speculative();
+        }
+    }
+    queue_cv.notify_one();
+}
+
+void RenderPool::preempt_speculative() {
+    // Only needed when every worker is busy; then the visible job takes the
+    // place of a speculative one, which is retried afterwards
+    if (running.size() < workers.size()) return;
+    for (auto &active : running) {
+        if (active.job.speculative && !active.cookie.abort) {
+            active.cookie.abort = 1;
+            active.requeue = true;
+            return;
+        }
+    }
+}
+
+void RenderPool::cancel_if(const std::function<bool(const RenderJob &)> &matches) {
+    std::lock_guard lock(queue_mutex);
+    const auto cancelled = std::stable_partition(pending.begin(), pending.end(),
+        [&matches](const RenderJob &job) { return !matches(job); });
+    for (auto it = cancelled; it != pending.end(); ++it) {
+        if (!it->target) continue;
+        RenderResult result;
+        result.job = *it;
+        result.cancelled = true;
+        finished.push_back(result);
+    }
+    pending.erase(cancelled, pending.end());
+    for (auto &active : running) {
+        if (matches(active.job)) {
+            active.cookie.abort = 1;
+            active.requeue = false;
+        }
+    }
+}
+
+std::vector<RenderResult> RenderPool::take_results() {
+    std::lock_guard lock(queue_mutex);
+    std::vector<RenderResult> results;
+    results.swap(finished);
+    return results;
+}
+
+void RenderPool::worker_main(fz_context *worker_ctx) {
+    for (;;) {
+        std::list<Running>::iterator active;
+        {
+            std::unique_lock lock(queue_mutex);
+            queue_cv.wait(lock, [this] { return stopping || !pending.empty(); });
+            if (stopping) break;
+            active = running.insert(running.end(), Running{pending.front()});
+            pending.pop_front();
+        }
+
+        const RenderJob job = active->job;
+        const bool use_disk = job.persist && rasters && !job.prepare_only;
+        const TileKey key{job.page_num, TileKey::zoom_key(job.scale), job.tile_x, job.tile_y};
+        fz_pixmap *pix = use_disk ? rasters->load(worker_ctx, key) : nullptr;
+        // Written out after delivery, so the disk never delays the screen
+        fz_pixmap *to_store = nullptr;
+        if (!pix) {
+            pix = render(worker_ctx, job, &active->cookie);
+            // A tile drawn before all its data arrived is redrawn later.
+            // One drawn into the texture is copied, as the texture is
+            // handed back on delivery.
+            if (use_disk && pix && !active->cookie.incomplete) {
+                to_store = pix->samples == job.target ? clone_pixmap(worker_ctx, pix)
+                                                      : fz_keep_pixmap(worker_ctx, pix);
+            }
+        }
+        // Handed over with the result, so it is there even if the cache
+        // has dropped it again by the time the receiver looks
+        fz_stext_page *stext = nullptr;
+        if (job.prepare_only && job.warm_text && !active->cookie.abort) {
+            stext = pages.get_stext(worker_ctx, job.page_num, nullptr);
+        }
+        // Tiles not drawn in place are copied here, off the event thread
+        const bool in_target = pix && job.target && (pix->samples == job.target || copy_to_target(pix, job));
+
+        bool delivered = false;
+        {
+            std::lock_guard lock(queue_mutex);
+            if (!active->cookie.abort) {
+                RenderResult result;
+                result.job = job;
+                result.pix = pix;
+                result.stext = stext;
+                result.errors = active->cookie.errors;
+                result.incomplete = active->cookie.incomplete != 0;
+                result.in_target = in_target;
+                finished.push_back(result);
+                delivered = true;
+            } else if (active->requeue && !stopping) {
+                pending.push_back(job);
+            } else if (job.target) {
+                RenderResult result;
+                result.job = job;
+                result.cancelled = true;
+                finished.push_back(result);
+            }
+            running.erase(active);
+        }
+        if (!delivered) {
+            fz_drop_stext_page(worker_ctx, stext);
+            fz_drop_pixmap(worker_ctx, to_store);
+            fz_drop_pixmap(worker_ctx, pix);
+            continue;
+        }
+        if (on_ready) on_ready();
+
+        if (to_store) {
+            rasters->store(worker_ctx, key, to_store);
+            fz_drop_pixmap(worker_ctx, to_store);
+        }
+
+        if (job.warm_text && !job.prepare_only) {
+            fz_drop_stext_page(worker_ctx, pages.get_stext(worker_ctx, job.page_num, nullptr));
+        }
+    }
+    fz_drop_context(worker_ctx);
+}
+
+fz_pixmap *RenderPool::render(fz_context *worker_ctx, const RenderJob &job, fz_cookie *cookie) {
+    fz_rect rect = fz_empty_rect;
+    fz_display_list *list = pages.get_list(worker_ctx, job.page_num, &rect, cookie);
+    if (!list || job.prepare_only) {
+        fz_drop_display_list(worker_ctx, list);
+        return nullptr;
+    }
+    // Straight into the texture, unless the texture rows are padded or the
+    // tile is cut off at the page edge
+    unsigned char *samples = nullptr;
+    const fz_irect bbox = render_bbox(rect, job.scale, job.area);
+    const bool whole_area = bbox.x0 == job.area.x0 && bbox.y0 == job.area.y0
+        && bbox.x1 == job.area.x1 && bbox.y1 == job.area.y1;
+    const int row_bytes = (bbox.x1 - bbox.x0) * job.target_format.n;
+    if (job.target && whole_area && job.target_pitch == row_bytes) {
+        samples = job.target;
+    }
+    // Anything not drawn in place is plain RGB, which copy_to_target takes
+    fz_pixmap *pix = rasterize(worker_ctx, list, rect, job.scale, job.area, cookie, 8, 0, samples,
+                               samples ? job.target_format : PixelFormat{});
+    fz_drop_display_list(worker_ctx, list);
+    return pix;
+}
+
+fz_pixmap *RenderPool::clone_pixmap(fz_context *worker_ctx, const fz_pixmap *pix) {
+    fz_pixmap *copy = nullptr;
+    fz_try(worker_ctx) {
+        copy = fz_clone_pixmap(worker_ctx, pix);
+    }
+    fz_catch(worker_ctx) {
+        fz_report_error(worker_ctx);
+    }
+    return copy;
+}
+
+bool RenderPool::copy_to_target(const fz_pixmap *pix, const RenderJob &job) {
+    if (pix->n != 3 || pix->w != job.area.x1 - job.area.x0 || pix->h != job.area.y1 - job.area.y0) return false;
+    const PixelFormat &format = job.target_format;
+    for (int y = 0; y < pix->h; y++) {
+        const unsigned char *src = pix->samples + y * pix->stride;
+        unsigned char *dst = job.target + static_cast<size_t>(y) * job.target_pitch;
+        if (format.n == 3 && !format.bgr) {
+            std::memcpy(dst, src, static_cast<size_t>(pix->w) * 3);
+            continue;
+        }
+        const int r = format.bgr ? 2 : 0;
+        const int b = format.bgr ? 0 : 2;
+        for (int x = 0; x < pix->w; x++, src += 3, dst += format.n) {
+            dst[r] = src[0];
+            dst[1] = src[1];
+            dst[b] = src[2];
+            if (format.n == 4) dst[3] = 255;
+        }
+    }
+    return true;
+}
+
+fz_irect RenderPool::render_bbox(const fz_rect &bounds, const float scale, const fz_irect &area) {
+    const fz_irect page_bbox = fz_round_rect(fz_transform_rect(bounds, fz_scale(scale, scale)));
+    return fz_is_empty_irect(area) ? page_bbox : fz_intersect_irect(area, page_bbox);
+}
+
+fz_pixmap *RenderPool::rasterize(fz_context *worker_ctx, fz_display_list *list, const fz_rect &bounds,
+                                 const float scale, const fz_irect &area, fz_cookie *cookie,
+                                 const int aa_level, const int device_hints, unsigned char *samples,
+                                 const PixelFormat format) {
+    const AllocScope scope(AllocCategory::raster);
+    fz_device *dev = nullptr;
+    fz_pixmap *pix = nullptr;
+
+    fz_var(dev);
+    fz_var(pix);
+    fz_try(worker_ctx) {
+        // Maximize Anti-Aliasing unless asked otherwise
+        fz_set_aa_level(worker_ctx, aa_level);
+
+        const fz_matrix ctm = fz_scale(scale, scale);
+        const fz_irect bbox = render_bbox(bounds, scale, area);
+
+        // 0 = No alpha, results in cleaner text contrast. Four-byte layouts
+        // need the alpha byte, which stays opaque over the white fill.
+        fz_colorspace *colorspace = format.bgr ? fz_device_bgr(worker_ctx) : fz_device_rgb(worker_ctx);
+        const int alpha = format.n == 4 ? 1 : 0;
+        if (samples) {
+            pix = fz_new_pixmap_with_bbox_and_data(worker_ctx, colorspace, bbox, nullptr, alpha, samples);
+        } else {
+            pix = fz_new_pixmap_with_bbox(worker_ctx, colorspace, bbox, nullptr, alpha);
+        }
+        fz_clear_pixmap_with_value(worker_ctx, pix, 255);
+
+        // With the tile as scissor the list skips every node outside it
+        dev = fz_new_draw_device_with_bbox(worker_ctx, fz_identity, pix, &bbox);
+        if (device_hints) fz_enable_device_hints(worker_ctx, dev, device_hints);
+        fz_run_display_list(worker_ctx, list, dev, ctm, fz_rect_from_irect(bbox), cookie);
+        fz_close_device(worker_ctx, dev);
+    }
+    fz_always(worker_ctx) {
+        fz_drop_device(worker_ctx, dev);
+    }
+    fz_catch(worker_ctx) {
+        fz_drop_pixmap(worker_ctx, pix);
+        pix = nullptr;
+        fz_report_error(worker_ctx);
+    }
+    return pix;
+}
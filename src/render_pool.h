@@ -0,0 +1,144 @@
+#ifndef PDFF_RENDER_POOL_H
+#define PDFF_RENDER_POOL_H
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+extern "C" {
+    #include <mupdf/fitz.h>
+}
+
+#include "page_cache.h"
+#include "raster_cache.h"
+
+// Byte layout of drawn pixels. Four bytes per pixel carry an opaque alpha
+// byte, which is padding to the texture; MuPDF only writes PNGs from RGB.
+struct PixelFormat {
+    int n = 3;
+    bool bgr = false;
+};
+
+struct RenderJob {
+    int page_num = 0;
+    float scale = 1.0f;
+    // Device-space part of the page to draw; empty means the whole page
+    fz_irect area = fz_empty_irect;
+    // Which tile `area` is, for the receiver's bookkeeping
+    int tile_x = 0;
+    int tile_y = 0;
+    // Only record the display list (and with it the page bounds)
+    bool prepare_only = false;
+    // Build the page's structured text once the pixmap is delivered, so the
+    // first selection on it does not have to. With prepare_only the text
+    // is built before the job is delivered, for a receiver waiting on it.
+    bool warm_text = false;
+    // Prefetch of a page that is not on screen yet. Runs only when no
+    // visible work is queued and yields its worker to visible work.
+    bool speculative = false;
+    // Worth keeping on disk: taken from `rasters` if it is there, written
+    // to it once rendered
+    bool persist = false;
+    // Locked texture memory the size of `area`, `target_pitch` bytes per
+    // row, to put the tile in instead of handing over a pixmap to upload.
+    // Every job with a target comes back from take_results(), cancelled
+    // or not, so the receiver can unlock it.
+    unsigned char *target = nullptr;
+    int target_pitch = 0;
+    PixelFormat target_format;
+};
+
+// A finished job. `pix` is owned by the receiver and must be dropped with
+// fz_drop_pixmap; it is nullptr for prepare_only jobs and if the page
+// failed to render. `stext` likewise, for prepare_only jobs with warm_text;
+// nullptr if the text could not be extracted.
+struct RenderResult {
+    RenderJob job;
+    fz_pixmap *pix = nullptr;
+    fz_stext_page *stext = nullptr;
+    // From the job's cookie: errors MuPDF skipped over while drawing, and
+    // whether data was missing (progressive loading), so `pix` may lack parts
+    int errors = 0;
+    bool incomplete = false;
+    // The tile is in job.target; `pix` may point into it and must be
+    // dropped before the target is unlocked
+    bool in_target = false;
+    // Aborted job, only handed back to return job.target
+    bool cancelled = false;
+};
+
+// How far along the running visible jobs are. `done` and `total` only count
+// jobs that know their total, i.e. are past recording their display list.
+struct RenderProgress {
+    int jobs = 0;
+    size_t done = 0;
+    size_t total = 0;
+};
+
+// Rasterizes pages on worker threads, each running on its own clone of the
+// main fz_context. Pages are drawn from the display lists in `pages`, so
+// workers only contend for the document when a list has to be recorded.
+// Every running job has an fz_cookie, which is how jobs get cancelled.
+class RenderPool {
+    public:
+        RenderPool(fz_context *ctx, PageCache &pages, unsigned int threads, std::function<void()> on_ready,
+                   RasterCache *rasters = nullptr);
+        ~RenderPool();
+        RenderPool(const RenderPool &) = delete;
+        RenderPool &operator=(const RenderPool &) = delete;
+
+        void submit(const RenderJob &job);
+        // Drop queued jobs and abort running ones that match. Aborted jobs
+        // only show up in take_results() if they have a target.
+        void cancel_if(const std::function<bool(const RenderJob &)> &matches);
+        std::vector<RenderResult> take_results();
+
+        static unsigned int default_thread_count();
+        // Draw `area` (whole page if empty) of a recorded page at `scale`
+        // into a new white RGB pixmap; nullptr on failure or abort.
+        // `device_hints` are fz_enable_device_hints flags. With `samples`
+        // the pixmap draws into that memory, rows packed, which must fit
+        // render_bbox(). `format` is the layout of the pixels.
+        static fz_pixmap *rasterize(fz_context *worker_ctx, fz_display_list *list, const fz_rect &bounds,
+                                    float scale, const fz_irect &area, fz_cookie *cookie,
+                                    int aa_level = 8, int device_hints = 0, unsigned char *samples = nullptr,
+                                    PixelFormat format = {});
+        // Pixels rasterize() draws
+        static fz_irect render_bbox(const fz_rect &bounds, float scale, const fz_irect &area);
+        // Whether any job is queued or running
+        bool busy();
+        // Read from the cookies of running jobs, without waiting on them
+        RenderProgress progress();
+    private:
+        struct Running {
+            RenderJob job;
+            fz_cookie cookie{};
+            // Aborted to make room for visible work; goes back in the queue
+            bool requeue = false;
+        };
+
+        fz_context *ctx;
+        PageCache &pages;
+        std::function<void()> on_ready;
+        RasterCache *rasters;
+
+        std::vector<std::thread> workers;
+        std::mutex queue_mutex;
+        std::condition_variable queue_cv;
+        std::deque<RenderJob> pending; // visible jobs ahead of speculative ones
+        std::list<Running> running;
+        std::vector<RenderResult> finished;
+        bool stopping = false;
+
+        void worker_main(fz_context *worker_ctx);
+        fz_pixmap *render(fz_context *worker_ctx, const RenderJob &job, fz_cookie *cookie);
+        static fz_pixmap *clone_pixmap(fz_context *worker_ctx, const fz_pixmap *pix);
+        static bool copy_to_target(const fz_pixmap *pix, const RenderJob &job);
+        void preempt_speculative();
+};
+
+
+#endif //PDFF_RENDER_POOL_H
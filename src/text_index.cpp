@@ -0,0 +1,315 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <stdexcept>
+#include "text_index.h"
+
+namespace fs = std::filesystem;
+
+// How often the worker checks whether the main pool has gone idle
+static constexpr auto idle_poll = std::chrono::milliseconds(15);
+static const char index_magic[8] = {'p', 'd', 'f', 'f', 'i', 'd', 'x', '1'};
+// Words indexed at a line-end hyphen sit one position off from the words
+// after them, so phrase positions may be that much apart
+static constexpr uint32_t max_word_gap = 2;
+
+// Anything not a letter or digit splits words, the same for the page text
+// and the search text; only both sides agreeing matters
+static bool is_word_rune(const int c) {
+    if (c < 0x80) return std::isalnum(c) != 0;
+    // Latin-1 symbols and spaces, general punctuation, ideographic spaces
+    return !(c <= 0xBF || (c >= 0x2000 && c <= 0x206F) || (c >= 0x3000 && c <= 0x3003));
+}
+
+static bool is_hyphen(const int c) {
+    return c == '-' || c == 0xAD || c == 0x2010 || c == 0x2011;
+}
+
+static void append_lower(std::string *word, const int c) {
+    char utf8[FZ_UTFMAX];
+    word->append(utf8, fz_runetochar(utf8, fz_tolower(c)));
+}
+
+namespace {
+    // Numbers the words of one page in reading order
+    struct WordCollector {
+        std::unordered_map<std::string, std::vector<uint32_t>> *words = nullptr;
+        std::string word;
+        uint32_t position = 0;
+        // Word before a hyphen that ended the last line; searching ignores
+        // such hyphens, so the word is also indexed joined to the next one
+        std::string hyphen_head;
+
+        void end_word() {
+            if (word.empty()) return;
+            (*words)[word].push_back(position);
+            if (!hyphen_head.empty()) {
+                (*words)[hyphen_head + word].push_back(position);
+                hyphen_head.clear();
+            }
+            position++;
+            word.clear();
+        }
+
+        void add_line(const fz_stext_line *line) {
+            // Word a hyphen just ended, while nothing else followed
+            std::string before_hyphen;
+            for (const fz_stext_char *ch = line->first_char; ch; ch = ch->next) {
+                if (is_word_rune(ch->c)) {
+                    append_lower(&word, ch->c);
+                    before_hyphen.clear();
+                } else {
+                    before_hyphen = is_hyphen(ch->c) ? word : std::string();
+                    end_word();
+                }
+            }
+            end_word();
+            hyphen_head = before_hyphen;
+        }
+
+        void add_blocks(const fz_stext_block *block) {
+            for (; block; block = block->next) {
+                if (block->type == FZ_STEXT_BLOCK_TEXT) {
+                    for (const fz_stext_line *line = block->u.t.first_line; line; line = line->next) {
+                        add_line(line);
+                    }
+                } else if (block->type == FZ_STEXT_BLOCK_STRUCT && block->u.s.down) {
+                    add_blocks(block->u.s.down->first_block);
+                }
+            }
+        }
+    };
+}
+
+// The words of a search text, split and lowercased like page text
+static std::vector<std::string> split_words(const std::string &text) {
+    std::vector<std::string> words;
+    std::string word;
+    const char *p = text.c_str();
+    while (*p) {
+        int c;
+        p += fz_chartorune(&c, p);
+        if (is_word_rune(c)) {
+            append_lower(&word, c);
+        } else if (!word.empty()) {
+            words.push_back(word);
+            word.clear();
+        }
+    }
+    if (!word.empty()) words.push_back(word);
+    return words;
+}
+
+static void write_u32(std::ostream &out, const uint32_t value) {
+    out.write(reinterpret_cast<const char *>(&value), sizeof value);
+}
+
+static bool read_u32(std::istream &in, uint32_t *value) {
+    return static_cast<bool>(in.read(reinterpret_cast<char *>(value), sizeof *value));
+}
+
+TextIndex::TextIndex(fz_context *ctx, PageCache &pages, RenderPool &main_pool, const int page_count,
+                     std::string path, const size_t budget_bytes)
+    : ctx(ctx), pages(pages), main_pool(main_pool), page_count(page_count), path(std::move(path)),
+      budget(budget_bytes) {
+    // Clone on this thread: fz_clone_context needs the parent to be idle
+    fz_context *worker_ctx = fz_clone_context(ctx);
+    if (!worker_ctx) throw std::runtime_error("Cannot clone MuPDF context");
+    worker = std::thread(&TextIndex::worker_main, this, worker_ctx);
+}
+
+TextIndex::~TextIndex() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+    worker.join();
+}
+
+void TextIndex::build() {
+    {
+        std::lock_guard lock(mutex);
+        building = true;
+    }
+    cv.notify_all();
+}
+
+size_t TextIndex::used_bytes() {
+    std::lock_guard lock(mutex);
+    return bytes;
+}
+
+size_t TextIndex::posting_bytes(const std::string &term, const std::vector<uint32_t> &positions) {
+    // Charged the term for every posting, as if no page shared words
+    return sizeof(Posting) + term.size() + positions.size() * sizeof(uint32_t);
+}
+
+std::vector<bool> TextIndex::candidates(const std::string &needle) {
+    const std::vector<std::string> query = split_words(needle);
+    std::vector<bool> maybe(page_count, true);
+    std::lock_guard lock(mutex);
+    if (query.empty() || pages_indexed == 0) return maybe;
+
+    // Where each query word can be on each page. Search matches inside
+    // words, so every indexed word containing a query word counts.
+    std::vector<std::unordered_map<int, std::vector<uint32_t>>> places(query.size());
+    for (const auto &[term, postings] : terms) {
+        for (size_t i = 0; i < query.size(); i++) {
+            if (term.find(query[i]) == std::string::npos) continue;
+            for (const Posting &posting : postings) {
+                auto &positions = places[i][posting.page_num];
+                positions.insert(positions.end(), posting.positions.begin(), posting.positions.end());
+            }
+        }
+    }
+
+    std::fill(maybe.begin(), maybe.begin() + pages_indexed, false);
+    for (const auto &[page_num, first_positions] : places[0]) {
+        // Follow the query words along the page, each just after the last
+        std::set<uint32_t> reached(first_positions.begin(), first_positions.end());
+        for (size_t i = 1; i < query.size() && !reached.empty(); i++) {
+            const auto it = places[i].find(page_num);
+            if (it == places[i].end()) {
+                reached.clear();
+                break;
+            }
+            std::set<uint32_t> next;
+            for (const uint32_t position : it->second) {
+                const auto prev = reached.lower_bound(position >= max_word_gap ? position - max_word_gap : 0);
+                if (prev != reached.end() && *prev < position) next.insert(position);
+            }
+            reached.swap(next);
+        }
+        if (!reached.empty()) maybe[page_num] = true;
+    }
+    return maybe;
+}
+
+void TextIndex::worker_main(fz_context *worker_ctx) {
+    load();
+    for (;;) {
+        int page_num;
+        {
+            std::unique_lock lock(mutex);
+            cv.wait(lock, [this] {
+                return stopping || (building && pages_indexed < page_count && bytes < budget);
+            });
+            if (stopping) break;
+            page_num = pages_indexed;
+        }
+        // Pages on screen first; busy() takes the pool's own lock
+        if (main_pool.busy()) {
+            std::unique_lock lock(mutex);
+            cv.wait_for(lock, idle_poll, [this] { return stopping; });
+            continue;
+        }
+
+        PageTerms page_terms;
+        // A page without text (or one that cannot be loaded) has nothing
+        // for search to find either
+        if (fz_stext_page *stext = pages.get_stext_transient(worker_ctx, page_num, nullptr)) {
+            WordCollector collector;
+            collector.words = &page_terms;
+            collector.add_blocks(stext->first_block);
+            fz_drop_stext_page(worker_ctx, stext);
+        }
+        add_page(page_num, page_terms);
+        if (page_num == page_count - 1) save();
+    }
+    // Half an index is still worth keeping; the next open carries on
+    if (dirty) save();
+    fz_drop_context(worker_ctx);
+}
+
+void TextIndex::add_page(const int page_num, PageTerms &page_terms) {
+    std::lock_guard lock(mutex);
+    for (auto &[term, positions] : page_terms) {
+        bytes += posting_bytes(term, positions);
+        terms[term].push_back({page_num, std::move(positions)});
+    }
+    pages_indexed = page_num + 1;
+    dirty = true;
+}
+
+bool TextIndex::load() {
+    if (path.empty()) return false;
+    std::ifstream in(path, std::ios::binary);
+    char magic[sizeof index_magic];
+    uint32_t count = 0;
+    uint32_t indexed = 0;
+    uint32_t term_count = 0;
+    if (!in.read(magic, sizeof magic) || !std::equal(magic, magic + sizeof magic, index_magic)) return false;
+    if (!read_u32(in, &count) || !read_u32(in, &indexed) || !read_u32(in, &term_count)) return false;
+    if (count != static_cast<uint32_t>(page_count) || indexed > count) return false;
+
+    std::unordered_map<std::string, std::vector<Posting>> loaded;
+    size_t loaded_bytes = 0;
+    loaded.reserve(term_count);
+    for (uint32_t t = 0; t < term_count; t++) {
+        uint32_t length = 0;
+        uint32_t posting_count = 0;
+        if (!read_u32(in, &length) || length > 4096) return false;
+        std::string term(length, '\0');
+        if (!in.read(term.data(), length) || !read_u32(in, &posting_count)) return false;
+        std::vector<Posting> &postings = loaded[term];
+        postings.reserve(posting_count);
+        for (uint32_t p = 0; p < posting_count; p++) {
+            uint32_t page_num = 0;
+            uint32_t position_count = 0;
+            if (!read_u32(in, &page_num) || !read_u32(in, &position_count)) return false;
+            if (page_num >= indexed || position_count > (1u << 24)) return false;
+            std::vector<uint32_t> positions(position_count);
+            if (!in.read(reinterpret_cast<char *>(positions.data()), position_count * sizeof(uint32_t))) {
+                return false;
+            }
+            loaded_bytes += posting_bytes(term, positions);
+            postings.push_back({static_cast<int>(page_num), std::move(positions)});
+        }
+    }
+
+    std::lock_guard lock(mutex);
+    terms.swap(loaded);
+    pages_indexed = static_cast<int>(indexed);
+    bytes = loaded_bytes;
+    return true;
+}
+
+void TextIndex::save() {
+    if (path.empty()) return;
+    // Only this thread changes the index, so it can be read unlocked
+    const int indexed = pages_indexed;
+    // Written aside and renamed, so another instance never reads half a file
+    const std::string partial = path + ".part";
+    {
+        std::ofstream out(partial, std::ios::binary | std::ios::trunc);
+        out.write(index_magic, sizeof index_magic);
+        write_u32(out, page_count);
+        write_u32(out, indexed);
+        write_u32(out, static_cast<uint32_t>(terms.size()));
+        for (const auto &[term, postings] : terms) {
+            write_u32(out, static_cast<uint32_t>(term.size()));
+            out.write(term.data(), static_cast<std::streamsize>(term.size()));
+            write_u32(out, static_cast<uint32_t>(postings.size()));
+            for (const Posting &posting : postings) {
+                write_u32(out, posting.page_num);
+                write_u32(out, static_cast<uint32_t>(posting.positions.size()));
+                out.write(reinterpret_cast<const char *>(posting.positions.data()),
+                          static_cast<std::streamsize>(posting.positions.size() * sizeof(uint32_t)));
+            }
+        }
+        if (!out) {
+            std::error_code error;
+            fs::remove(partial, error);
+            return;
+        }
+    }
+    std::error_code error;
+    fs::rename(partial, path, error);
+    if (error) fs::remove(partial, error);
+    dirty = false;
+}
@@ -0,0 +1,79 @@
+#ifndef PDFF_TEXT_INDEX_H
+#define PDFF_TEXT_INDEX_H
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+extern "C" {
+    #include <mupdf/fitz.h>
+}
+
+#include "page_cache.h"
+#include "render_pool.h"
+
+// Inverted index of the document's words: each lowercased word with the
+// pages it is on and its word positions there. Built page by page on a
+// worker context while `main_pool` is idle and kept in the document's
+// cache directory, so only the first search of a document has to read
+// every page. A partly built index is saved on exit and resumed on the
+// next open. Indexing stops once the index takes `budget_bytes`; the pages
+// after that are simply searched in full.
+//
+// The index only narrows a search down; the pages it lets through are
+// still searched for real, which also gives the highlight quads.
+class TextIndex {
+    public:
+        // `path` is where the index is kept; empty keeps it in memory only
+        TextIndex(fz_context *ctx, PageCache &pages, RenderPool &main_pool, int page_count, std::string path,
+                  size_t budget_bytes);
+        ~TextIndex();
+        TextIndex(const TextIndex &) = delete;
+        TextIndex &operator=(const TextIndex &) = delete;
+
+        // Index the pages not indexed yet. Held back for progressive files
+        // until all their data is there, so no page is indexed half loaded.
+        void build();
+        // One flag per page, false where `needle` cannot be. Pages not
+        // indexed yet are always flagged.
+        std::vector<bool> candidates(const std::string &needle);
+        // Rough size of the index in memory
+        size_t used_bytes();
+    private:
+        struct Posting {
+            int page_num;
+            std::vector<uint32_t> positions;
+        };
+        using PageTerms = std::unordered_map<std::string, std::vector<uint32_t>>;
+
+        fz_context *ctx;
+        PageCache &pages;
+        RenderPool &main_pool;
+        const int page_count;
+        const std::string path;
+        const size_t budget;
+
+        std::thread worker;
+        std::mutex mutex;
+        std::condition_variable cv;
+        // Postings are in page order; pages below pages_indexed are done
+        std::unordered_map<std::string, std::vector<Posting>> terms;
+        int pages_indexed = 0;
+        size_t bytes = 0;
+        bool building = false;
+        bool stopping = false;
+        // Pages were added since the index was last saved
+        bool dirty = false;
+
+        void worker_main(fz_context *worker_ctx);
+        void add_page(int page_num, PageTerms &page_terms);
+        static size_t posting_bytes(const std::string &term, const std::vector<uint32_t> &positions);
+        bool load();
+        void save();
+};
+
+
+#endif //PDFF_TEXT_INDEX_H
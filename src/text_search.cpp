@@ -0,0 +1,127 @@
+#include <chrono>
+#include <stdexcept>
+#include "text_search.h"
+
+// How often the worker checks whether the main pool has gone idle
+static constexpr auto idle_poll = std::chrono::milliseconds(15);
+// Pages searched between progress updates when nothing is found
+static constexpr int report_every = 32;
+
+TextSearch::TextSearch(fz_context *ctx, PageCache &pages, RenderPool &main_pool, const int page_count,
+                       std::function<void()> on_ready, TextIndex *index)
+    : ctx(ctx), pages(pages), main_pool(main_pool), page_count(page_count), on_ready(std::move(on_ready)),
+      index(index) {
+    // Clone on this thread: fz_clone_context needs the parent to be idle
+    fz_context *worker_ctx = fz_clone_context(ctx);
+    if (!worker_ctx) throw std::runtime_error("Cannot clone MuPDF context");
+    worker = std::thread(&TextSearch::worker_main, this, worker_ctx);
+}
+
+TextSearch::~TextSearch() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+    worker.join();
+}
+
+void TextSearch::start(const std::string &text, const int from_page) {
+    {
+        std::lock_guard lock(mutex);
+        needle = text;
+        first_page = from_page;
+        generation++;
+        searched = 0;
+        found.clear();
+    }
+    cv.notify_all();
+}
+
+void TextSearch::cancel() {
+    start("", 0);
+}
+
+std::vector<SearchHit> TextSearch::take_hits() {
+    std::lock_guard lock(mutex);
+    std::vector<SearchHit> hits;
+    hits.swap(found);
+    return hits;
+}
+
+int TextSearch::pages_searched() {
+    std::lock_guard lock(mutex);
+    return searched;
+}
+
+bool TextSearch::is_current(const unsigned int search) {
+    std::lock_guard lock(mutex);
+    return !stopping && generation == search;
+}
+
+int TextSearch::on_hit(fz_context *, void *opaque, const int num_quads, fz_quad *hit_bbox) {
+    auto *hits = static_cast<std::vector<SearchHit> *>(opaque);
+    hits->push_back({0, std::vector<fz_quad>(hit_bbox, hit_bbox + num_quads)});
+    return 0;
+}
+
+void TextSearch::worker_main(fz_context *worker_ctx) {
+    unsigned int done_with = 0;
+    for (;;) {
+        std::string text;
+        int from = 0;
+        unsigned int search = 0;
+        {
+            std::unique_lock lock(mutex);
+            cv.wait(lock, [this, done_with] { return stopping || generation != done_with; });
+            if (stopping) break;
+            text = needle;
+            from = first_page;
+            search = generation;
+        }
+        done_with = search;
+        if (text.empty()) continue;
+
+        // Pages the index rules out count as searched right away
+        const std::vector<bool> maybe = index ? index->candidates(text) : std::vector<bool>();
+        int unreported = 0;
+        for (int i = 0; i < page_count && is_current(search); i++) {
+            const int page_num = (from + i) % page_count;
+            const bool skip = !maybe.empty() && !maybe[page_num];
+            // Pages on screen first; busy() takes the pool's own lock
+            while (!skip && main_pool.busy() && is_current(search)) {
+                std::this_thread::sleep_for(idle_poll);
+            }
+            std::vector<SearchHit> hits;
+            // nullptr if the page is broken or, in a progressive file, not
+            // there yet; either way it has nothing to find
+            fz_stext_page *stext = skip ? nullptr : pages.get_stext_transient(worker_ctx, page_num, nullptr);
+            if (stext) {
+                fz_try(worker_ctx) {
+                    fz_search_stext_page_cb(worker_ctx, stext, text.c_str(), on_hit, &hits);
+                }
+                fz_always(worker_ctx) {
+                    fz_drop_stext_page(worker_ctx, stext);
+                }
+                fz_catch(worker_ctx) {
+                    fz_report_error(worker_ctx);
+                }
+            }
+            for (auto &hit : hits) {
+                hit.page_num = page_num;
+            }
+
+            {
+                std::lock_guard lock(mutex);
+                if (generation != search) break;
+                searched++;
+                found.insert(found.end(), hits.begin(), hits.end());
+            }
+            if (!hits.empty() || (!skip && ++unreported >= report_every) || i == page_count - 1) {
+                unreported = 0;
+                if (on_ready) on_ready();
+            }
+        }
+    }
+    fz_drop_context(worker_ctx);
+}
@@ -0,0 +1,71 @@
+#ifndef PDFF_TEXT_SEARCH_H
+#define PDFF_TEXT_SEARCH_H
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+    #include <mupdf/fitz.h>
+}
+
+#include "page_cache.h"
+#include "render_pool.h"
+#include "text_index.h"
+
+// One occurrence of the search text; long hits wrap over several quads
+struct SearchHit {
+    int page_num = 0;
+    std::vector<fz_quad> quads;
+};
+
+// Searches the whole document on a worker context, one page at a time, so
+// hits on the first pages arrive while the rest are still being scanned.
+// Pages whose text is cached are searched as they are; the others have
+// their text built and dropped again, leaving the caches to the pages
+// being read. Like thumbnails, pages are only loaded while `main_pool` is
+// idle. With an `index`, pages it rules out are not read at all.
+class TextSearch {
+    public:
+        TextSearch(fz_context *ctx, PageCache &pages, RenderPool &main_pool, int page_count,
+                   std::function<void()> on_ready, TextIndex *index = nullptr);
+        ~TextSearch();
+        TextSearch(const TextSearch &) = delete;
+        TextSearch &operator=(const TextSearch &) = delete;
+
+        // Look for `needle` on every page, starting at `first_page` and
+        // wrapping around. Replaces any search in progress.
+        void start(const std::string &needle, int first_page);
+        void cancel();
+        // Hits of the current search found since the last call
+        std::vector<SearchHit> take_hits();
+        // Pages the current search has been through, out of page_count
+        int pages_searched();
+    private:
+        fz_context *ctx;
+        PageCache &pages;
+        RenderPool &main_pool;
+        const int page_count;
+        std::function<void()> on_ready;
+        TextIndex *index;
+
+        std::thread worker;
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::string needle;
+        int first_page = 0;
+        // Bumped by start() and cancel(); the worker drops work of older ones
+        unsigned int generation = 0;
+        int searched = 0;
+        std::vector<SearchHit> found;
+        bool stopping = false;
+
+        void worker_main(fz_context *worker_ctx);
+        bool is_current(unsigned int search);
+        static int on_hit(fz_context *ctx, void *opaque, int num_quads, fz_quad *hit_bbox);
+};
+
+
+#endif //PDFF_TEXT_SEARCH_H
@@ -0,0 +1,89 @@
+#include "texture_pool.h"
+
+TexturePool::TexturePool(SDL_Renderer *renderer, const size_t max_idle_bytes, const Uint32 format)
+    : renderer(renderer), max_idle(max_idle_bytes), sdl_format(format) {
+    pixel_format(format, &pixels);
+}
+
+TexturePool::~TexturePool() {
+    clear();
+}
+
+uint64_t TexturePool::size_key(const int w, const int h) {
+    return static_cast<uint64_t>(static_cast<uint32_t>(w)) << 32 | static_cast<uint32_t>(h);
+}
+
+size_t TexturePool::texture_bytes(const int w, const int h) const {
+    return static_cast<size_t>(w) * h * pixels.n;
+}
+
+Uint32 TexturePool::preferred_format(SDL_Renderer *renderer) {
+    SDL_RendererInfo info;
+    if (SDL_GetRendererInfo(renderer, &info) == 0) {
+        // Listed best first; anything else gets converted on every upload
+        for (Uint32 i = 0; i < info.num_texture_formats; i++) {
+            PixelFormat layout;
+            if (pixel_format(info.texture_formats[i], &layout)) return info.texture_formats[i];
+        }
+    }
+    return SDL_PIXELFORMAT_RGB24;
+}
+
+bool TexturePool::pixel_format(const Uint32 sdl_format, PixelFormat *layout) {
+    // Formats named by their byte order, then packed ones whose byte order
+    // depends on the machine
+    if (sdl_format == SDL_PIXELFORMAT_RGB24) {
+        *layout = {3, false};
+    } else if (sdl_format == SDL_PIXELFORMAT_BGR24) {
+        *layout = {3, true};
+    } else if (sdl_format == SDL_PIXELFORMAT_RGBA32) {
+        *layout = {4, false};
+    } else if (sdl_format == SDL_PIXELFORMAT_BGRA32) {
+        *layout = {4, true};
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+    } else if (sdl_format == SDL_PIXELFORMAT_RGB888) {
+        *layout = {4, true};
+    } else if (sdl_format == SDL_PIXELFORMAT_BGR888) {
+        *layout = {4, false};
+#endif
+    } else {
+        return false;
+    }
+    return true;
+}
+
+SDL_Texture *TexturePool::acquire(const int w, const int h) {
+    if (w <= 0 || h <= 0) return nullptr;
+    if (const auto it = idle.find(size_key(w, h)); it != idle.end() && !it->second.empty()) {
+        SDL_Texture *tex = it->second.back();
+        it->second.pop_back();
+        idle_used -= texture_bytes(w, h);
+        return tex;
+    }
+    SDL_Texture *tex = SDL_CreateTexture(renderer, sdl_format, SDL_TEXTUREACCESS_STREAMING, w, h);
+    // Tiles are opaque; blending them would only cost fill rate
+    if (tex) SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_NONE);
+    return tex;
+}
+
+void TexturePool::release(SDL_Texture *tex) {
+    if (!tex) return;
+    int w = 0;
+    int h = 0;
+    if (SDL_QueryTexture(tex, nullptr, nullptr, &w, &h) != 0 || idle_used + texture_bytes(w, h) > max_idle) {
+        SDL_DestroyTexture(tex);
+        return;
+    }
+    idle[size_key(w, h)].push_back(tex);
+    idle_used += texture_bytes(w, h);
+}
+
+void TexturePool::clear() {
+    for (auto &[key, textures] : idle) {
+        for (SDL_Texture *tex : textures) {
+            SDL_DestroyTexture(tex);
+        }
+    }
+    idle.clear();
+    idle_used = 0;
+}
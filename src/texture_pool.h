@@ -0,0 +1,52 @@
+#ifndef PDFF_TEXTURE_POOL_H
+#define PDFF_TEXTURE_POOL_H
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <SDL2/SDL.h>
+
+#include "render_pool.h"
+
+// Streaming textures kept for reuse by size. Nearly every tile is
+// TileGrid::tile_size square, so a tile evicted from the cache hands its
+// texture to the next one instead of the driver freeing and allocating one
+// per tile. Event thread only, like everything else touching the renderer.
+class TexturePool {
+    public:
+        // At most `max_idle_bytes` of textures are kept around unused.
+        // `format` must be one pixel_format() knows.
+        TexturePool(SDL_Renderer *renderer, size_t max_idle_bytes, Uint32 format = SDL_PIXELFORMAT_RGB24);
+        ~TexturePool();
+        TexturePool(const TexturePool &) = delete;
+        TexturePool &operator=(const TexturePool &) = delete;
+
+        // A streaming texture of w x h; nullptr if SDL has none
+        SDL_Texture *acquire(int w, int h);
+        // Takes `tex` back; it must not be locked
+        void release(SDL_Texture *tex);
+        // Destroy the idle textures
+        void clear();
+        size_t idle_bytes() const { return idle_used; }
+        Uint32 format() const { return sdl_format; }
+        const PixelFormat &layout() const { return pixels; }
+        // Memory a w x h texture of format() takes
+        size_t texture_bytes(int w, int h) const;
+
+        // First texture format the renderer takes without converting that
+        // MuPDF can also draw; RGB24 if there is none
+        static Uint32 preferred_format(SDL_Renderer *renderer);
+        // The MuPDF layout of `sdl_format`, false if there is none
+        static bool pixel_format(Uint32 sdl_format, PixelFormat *layout);
+    private:
+        SDL_Renderer *renderer;
+        const size_t max_idle;
+        const Uint32 sdl_format;
+        PixelFormat pixels;
+        size_t idle_used = 0;
+        std::unordered_map<uint64_t, std::vector<SDL_Texture *>> idle;
+
+        static uint64_t size_key(int w, int h);
+};
+
+
+#endif //PDFF_TEXTURE_POOL_H
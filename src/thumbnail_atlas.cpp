@@ -0,0 +1,62 @@
+#include <algorithm>
+#include "thumbnail_atlas.h"
+
+ThumbnailAtlas::ThumbnailAtlas(SDL_Renderer *renderer, const int cell_w, const int cell_h, const int max_textures)
+    : renderer(renderer), cell_w(cell_w), cell_h(cell_h), cols(texture_size / cell_w),
+      per_texture((texture_size / cell_w) * (texture_size / cell_h)),
+      textures(std::max(max_textures, 1), nullptr), slots(textures.size() * per_texture) {
+}
+
+ThumbnailAtlas::~ThumbnailAtlas() {
+    for (SDL_Texture *tex : textures) {
+        if (tex) SDL_DestroyTexture(tex);
+    }
+}
+
+SDL_Rect ThumbnailAtlas::slot_rect(const int slot) const {
+    const int cell = slot % per_texture;
+    return {(cell % cols) * cell_w, (cell / cols) * cell_h, cell_w, cell_h};
+}
+
+bool ThumbnailAtlas::find(const int page_num, SDL_Texture **tex, SDL_Rect *src) {
+    const auto it = slot_of.find(page_num);
+    if (it == slot_of.end()) return false;
+    Slot &slot = slots[it->second];
+    slot.last_use = ++clock;
+    *tex = textures[it->second / per_texture];
+    *src = slot_rect(it->second);
+    src->w = slot.w;
+    src->h = slot.h;
+    return true;
+}
+
+int ThumbnailAtlas::free_slot() {
+    // Empty slots fill textures in order, so textures are created as needed
+    int oldest = 0;
+    for (int i = 0; i < static_cast<int>(slots.size()); i++) {
+        if (slots[i].page_num < 0) return i;
+        if (slots[i].last_use < slots[oldest].last_use) oldest = i;
+    }
+    slot_of.erase(slots[oldest].page_num);
+    slots[oldest].page_num = -1;
+    return oldest;
+}
+
+void ThumbnailAtlas::insert(const int page_num, const fz_pixmap *pix) {
+    if (!pix || contains(page_num)) return;
+    const int slot = free_slot();
+    SDL_Texture *&tex = textures[slot / per_texture];
+    if (!tex) {
+        tex = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB24, SDL_TEXTUREACCESS_STATIC,
+                                texture_size, texture_size);
+        if (!tex) return;
+    }
+
+    SDL_Rect dest = slot_rect(slot);
+    dest.w = std::min(pix->w, cell_w);
+    dest.h = std::min(pix->h, cell_h);
+    SDL_UpdateTexture(tex, &dest, pix->samples, static_cast<int>(pix->stride));
+
+    slots[slot] = {page_num, dest.w, dest.h, ++clock};
+    slot_of[page_num] = slot;
+}
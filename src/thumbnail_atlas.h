@@ -0,0 +1,51 @@
+#ifndef PDFF_THUMBNAIL_ATLAS_H
+#define PDFF_THUMBNAIL_ATLAS_H
+#include <unordered_map>
+#include <vector>
+#include <SDL2/SDL.h>
+
+extern "C" {
+    #include <mupdf/fitz.h>
+}
+
+// Thumbnails packed into a few large textures instead of one texture per
+// page. Every texture is a grid of cell_w x cell_h slots; once all
+// `max_textures` are full the least recently drawn thumbnail makes room.
+class ThumbnailAtlas {
+    public:
+        ThumbnailAtlas(SDL_Renderer *renderer, int cell_w, int cell_h, int max_textures);
+        ~ThumbnailAtlas();
+        ThumbnailAtlas(const ThumbnailAtlas &) = delete;
+        ThumbnailAtlas &operator=(const ThumbnailAtlas &) = delete;
+
+        // Texture and source rectangle of the page's thumbnail; counts as a use
+        bool find(int page_num, SDL_Texture **tex, SDL_Rect *src);
+        bool contains(int page_num) const { return slot_of.count(page_num) != 0; }
+        // Copies the pixmap in; the caller keeps it
+        void insert(int page_num, const fz_pixmap *pix);
+    private:
+        static constexpr int texture_size = 2048;
+
+        struct Slot {
+            int page_num = -1;
+            int w = 0;
+            int h = 0;
+            unsigned long last_use = 0;
+        };
+
+        SDL_Renderer *renderer;
+        const int cell_w;
+        const int cell_h;
+        const int cols;
+        const int per_texture;
+        std::vector<SDL_Texture *> textures;
+        std::vector<Slot> slots;
+        std::unordered_map<int, int> slot_of;
+        unsigned long clock = 0;
+
+        int free_slot();
+        SDL_Rect slot_rect(int slot) const;
+};
+
+
+#endif //PDFF_THUMBNAIL_ATLAS_H
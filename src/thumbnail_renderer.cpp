@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include "thumbnail_renderer.h"
+
+// How often a waiting worker checks whether the main pool has gone idle
+static constexpr auto idle_poll = std::chrono::milliseconds(15);
+// Thumbnails are too small for more anti-aliasing to show
+static constexpr int thumbnail_aa_level = 2;
+
+ThumbnailRenderer::ThumbnailRenderer(fz_context *ctx, PageCache &pages, RenderPool &main_pool,
+                                     const unsigned int threads, std::function<void()> on_ready)
+    : ctx(ctx), pages(pages), main_pool(main_pool), on_ready(std::move(on_ready)) {
+    for (unsigned int i = 0; i < std::max(1u, threads); i++) {
+        // Clone on this thread: fz_clone_context needs the parent to be idle
+        fz_context *worker_ctx = fz_clone_context(ctx);
+        if (!worker_ctx) {
+            if (workers.empty()) throw std::runtime_error("Cannot clone MuPDF context");
+            break;
+        }
+        workers.emplace_back(&ThumbnailRenderer::worker_main, this, worker_ctx);
+    }
+}
+
+ThumbnailRenderer::~ThumbnailRenderer() {
+    {
+        std::lock_guard lock(queue_mutex);
+        stopping = true;
+        pending.clear();
+        for (auto &job : running) {
+            job.cookie.abort = 1;
+        }
+    }
+    queue_cv.notify_all();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    for (auto &thumb : finished) {
+        fz_drop_pixmap(ctx, thumb.pix);
+    }
+}
+
+void ThumbnailRenderer::request(const std::vector<int> &page_nums) {
+    {
+        std::lock_guard lock(queue_mutex);
+        pending.clear();
+        for (const int page_num : page_nums) {
+            const bool is_running = std::any_of(running.begin(), running.end(), [page_num](const Running &job) {
+                return job.page_num == page_num;
+            });
+            if (!is_running) pending.push_back(page_num);
+        }
+    }
+    queue_cv.notify_all();
+}
+
+void ThumbnailRenderer::yield() {
+    std::lock_guard lock(queue_mutex);
+    for (auto &job : running) {
+        job.cookie.abort = 1;
+    }
+}
+
+std::vector<Thumbnail> ThumbnailRenderer::take_results() {
+    std::lock_guard lock(queue_mutex);
+    std::vector<Thumbnail> results;
+    results.swap(finished);
+    return results;
+}
+
+void ThumbnailRenderer::worker_main(fz_context *worker_ctx) {
+    for (;;) {
+        std::list<Running>::iterator active;
+        {
+            std::unique_lock lock(queue_mutex);
+            queue_cv.wait(lock, [this] { return stopping || !pending.empty(); });
+            if (stopping) break;
+        }
+        // Pages on screen first; busy() takes the pool's own lock
+        if (main_pool.busy()) {
+            std::unique_lock lock(queue_mutex);
+            queue_cv.wait_for(lock, idle_poll, [this] { return stopping; });
+            continue;
+        }
+        {
+            std::lock_guard lock(queue_mutex);
+            if (stopping) break;
+            if (pending.empty()) continue;
+            active = running.insert(running.end(), Running{pending.front()});
+            pending.pop_front();
+        }
+
+        const int page_num = active->page_num;
+        fz_pixmap *pix = render(worker_ctx, page_num, &active->cookie);
+
+        bool delivered = false;
+        {
+            std::lock_guard lock(queue_mutex);
+            if (!active->cookie.abort) {
+                finished.push_back({page_num, pix});
+                delivered = true;
+            } else if (!stopping) {
+                // Yielded to the main pool; try again once it is idle
+                pending.push_front(page_num);
+            }
+            running.erase(active);
+        }
+        if (!delivered) {
+            fz_drop_pixmap(worker_ctx, pix);
+            continue;
+        }
+        if (on_ready) on_ready();
+    }
+    fz_drop_context(worker_ctx);
+}
+
+fz_pixmap *ThumbnailRenderer::render(fz_context *worker_ctx, const int page_num, fz_cookie *cookie) {
+    fz_rect bounds = fz_empty_rect;
+    fz_display_list *list = pages.get_list_transient(worker_ctx, page_num, &bounds, cookie);
+    if (!list) return nullptr;
+
+    const float pw = bounds.x1 - bounds.x0;
+    const float ph = bounds.y1 - bounds.y0;
+    // Fit inside the cell; floor so rounding never spills over it
+    const float scale = std::min((cell_w - 1) / std::max(pw, 1.0f), (cell_h - 1) / std::max(ph, 1.0f));
+    // The draw device decodes images at the size they are drawn; NO_CACHE
+    // keeps those small copies from pushing full-size ones out of the store
+    fz_pixmap *pix = RenderPool::rasterize(worker_ctx, list, bounds, scale, fz_empty_irect, cookie,
+                                           thumbnail_aa_level, FZ_NO_CACHE | FZ_DONT_INTERPOLATE_IMAGES);
+    fz_drop_display_list(worker_ctx, list);
+    return pix;
+}
@@ -0,0 +1,69 @@
+#ifndef PDFF_THUMBNAIL_RENDERER_H
+#define PDFF_THUMBNAIL_RENDERER_H
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+extern "C" {
+    #include <mupdf/fitz.h>
+}
+
+#include "page_cache.h"
+#include "render_pool.h"
+
+struct Thumbnail {
+    int page_num = 0;
+    fz_pixmap *pix = nullptr; // owned by the receiver
+};
+
+// Renders page thumbnails for the sidebar on its own worker contexts, with
+// low anti-aliasing and images decoded at thumbnail size and kept out of
+// the store. Work only starts while `main_pool` is idle, and yield()
+// aborts thumbnails being drawn so the page on screen never waits behind
+// the strip. Lists recorded for thumbnails are not cached.
+class ThumbnailRenderer {
+    public:
+        // Largest thumbnail, in pixels; pages are fitted inside
+        static constexpr int cell_w = 128;
+        static constexpr int cell_h = 160;
+
+        ThumbnailRenderer(fz_context *ctx, PageCache &pages, RenderPool &main_pool, unsigned int threads,
+                          std::function<void()> on_ready);
+        ~ThumbnailRenderer();
+        ThumbnailRenderer(const ThumbnailRenderer &) = delete;
+        ThumbnailRenderer &operator=(const ThumbnailRenderer &) = delete;
+
+        // Replaces what is queued; most wanted first
+        void request(const std::vector<int> &page_nums);
+        // Abort running thumbnails; they go back to the front of the queue
+        void yield();
+        std::vector<Thumbnail> take_results();
+    private:
+        struct Running {
+            int page_num;
+            fz_cookie cookie{};
+        };
+
+        fz_context *ctx;
+        PageCache &pages;
+        RenderPool &main_pool;
+        std::function<void()> on_ready;
+
+        std::vector<std::thread> workers;
+        std::mutex queue_mutex;
+        std::condition_variable queue_cv;
+        std::deque<int> pending;
+        std::list<Running> running;
+        std::vector<Thumbnail> finished;
+        bool stopping = false;
+
+        void worker_main(fz_context *worker_ctx);
+        fz_pixmap *render(fz_context *worker_ctx, int page_num, fz_cookie *cookie);
+};
+
+
+#endif //PDFF_THUMBNAIL_RENDERER_H
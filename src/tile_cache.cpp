@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <cmath>
+#include "texture_pool.h"
+#include "tile_cache.h"
+
+SDL_FRect tile_dest(const TileGrid &grid, const int x, const int y, const SDL_FRect &dest) {
+    const fz_irect &bbox = grid.bbox;
+    const fz_irect r = grid.tile(x, y);
+    const float sx = dest.w / static_cast<float>(bbox.x1 - bbox.x0);
+    const float sy = dest.h / static_cast<float>(bbox.y1 - bbox.y0);
+    return {
+        dest.x + static_cast<float>(r.x0 - bbox.x0) * sx,
+        dest.y + static_cast<float>(r.y0 - bbox.y0) * sy,
+        static_cast<float>(r.x1 - r.x0) * sx,
+        static_cast<float>(r.y1 - r.y0) * sy
+    };
+}
+
+void visible_tile_range(const TileGrid &grid, const SDL_FRect &dest, const int win_w, const int win_h,
+                        int *x0, int *y0, int *x1, int *y1) {
+    const fz_irect &bbox = grid.bbox;
+    const int tile_size = TileGrid::tile_size;
+    if (grid.cols == 0 || grid.rows == 0 || dest.w <= 0 || dest.h <= 0) {
+        *x0 = *y0 = *x1 = *y1 = 0;
+        return;
+    }
+    // Window edges in page pixels, relative to the top-left tile
+    const float px = static_cast<float>(bbox.x1 - bbox.x0) / dest.w;
+    const float py = static_cast<float>(bbox.y1 - bbox.y0) / dest.h;
+    const float left = (0.0f - dest.x) * px;
+    const float top = (0.0f - dest.y) * py;
+    const float right = (static_cast<float>(win_w) - dest.x) * px;
+    const float bottom = (static_cast<float>(win_h) - dest.y) * py;
+
+    *x0 = std::clamp(static_cast<int>(std::floor(left / tile_size)), 0, grid.cols);
+    *y0 = std::clamp(static_cast<int>(std::floor(top / tile_size)), 0, grid.rows);
+    *x1 = std::clamp(static_cast<int>(std::ceil(right / tile_size)), 0, grid.cols);
+    *y1 = std::clamp(static_cast<int>(std::ceil(bottom / tile_size)), 0, grid.rows);
+}
+
+TileCache::TileCache(const size_t budget_bytes, TexturePool *textures)
+    : budget(budget_bytes), textures(textures) {}
+
+TileCache::~TileCache() {
+    clear();
+}
+
+void TileCache::begin_frame() {
+    frame++;
+}
+
+SDL_Texture *TileCache::find(const TileKey &key) {
+    const auto it = entries.find(key);
+    if (it == entries.end()) return nullptr;
+    lru.splice(lru.begin(), lru, it->second.lru_pos);
+    it->second.frame = frame;
+    return it->second.tex;
+}
+
+bool TileCache::contains(const TileKey &key) const {
+    return entries.count(key) != 0;
+}
+
+void TileCache::insert(const TileKey &key, SDL_Texture *tex, const size_t bytes) {
+    if (const auto it = entries.find(key); it != entries.end()) {
+        drop_texture(it->second.tex);
+        used -= it->second.bytes;
+        lru.erase(it->second.lru_pos);
+        entries.erase(it);
+    }
+    lru.push_front(key);
+    entries[key] = {tex, bytes, frame, lru.begin()};
+    used += bytes;
+    evict_over_budget();
+}
+
+void TileCache::clear() {
+    for (auto &[key, entry] : entries) {
+        drop_texture(entry.tex);
+    }
+    entries.clear();
+    lru.clear();
+    used = 0;
+}
+
+void TileCache::evict_over_budget() {
+    while (used > budget && !lru.empty()) {
+        const auto it = entries.find(lru.back());
+        if (it->second.frame == frame) break; // everything left is on screen
+        drop_texture(it->second.tex);
+        used -= it->second.bytes;
+        entries.erase(it);
+        lru.pop_back();
+    }
+}
+
+void TileCache::drop_texture(SDL_Texture *tex) {
+    if (textures) {
+        textures->release(tex);
+    } else {
+        SDL_DestroyTexture(tex);
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef PDFF_TILE_CACHE_H
+#define PDFF_TILE_CACHE_H
+#include <list>
+#include <unordered_map>
+#include <SDL2/SDL.h>
+
+#include "tile_grid.h"
+
+class TexturePool;
+
+// Where tile (x, y) of `grid` lands when the whole page is drawn to `dest`
+SDL_FRect tile_dest(const TileGrid &grid, int x, int y, const SDL_FRect &dest);
+// Range of tiles [x0, x1) x [y0, y1) of `grid` that intersect the window
+void visible_tile_range(const TileGrid &grid, const SDL_FRect &dest, int win_w, int win_h,
+                        int *x0, int *y0, int *x1, int *y1);
+
+// Uploaded tiles, least recently used evicted first once they take more
+// than `budget_bytes`. Tiles used since the last begin_frame() are never
+// evicted, so a frame does not lose tiles it is about to draw. Textures of
+// evicted tiles go back to `textures` if there is one.
+class TileCache {
+    public:
+        explicit TileCache(size_t budget_bytes, TexturePool *textures = nullptr);
+        ~TileCache();
+        TileCache(const TileCache &) = delete;
+        TileCache &operator=(const TileCache &) = delete;
+
+        void begin_frame();
+        SDL_Texture *find(const TileKey &key);
+        // Takes ownership of `tex`
+        void insert(const TileKey &key, SDL_Texture *tex, size_t bytes);
+        bool contains(const TileKey &key) const;
+        size_t used_bytes() const { return used; }
+        void clear();
+    private:
+        struct Entry {
+            SDL_Texture *tex = nullptr;
+            size_t bytes = 0;
+            unsigned long frame = 0;
+            std::list<TileKey>::iterator lru_pos;
+        };
+
+        const size_t budget;
+        TexturePool *textures;
+        size_t used = 0;
+        unsigned long frame = 0;
+        std::unordered_map<TileKey, Entry, TileKeyHash> entries;
+        std::list<TileKey> lru; // front = most recently used
+
+        void evict_over_budget();
+        void drop_texture(SDL_Texture *tex);
+};
+
+
+#endif //PDFF_TILE_CACHE_H
@@ -0,0 +1,22 @@
+#include <algorithm>
+#include <cmath>
+#include "tile_grid.h"
+
+TileGrid::TileGrid(const fz_rect &bounds, const float scale)
+    : bbox(fz_round_rect(fz_transform_rect(bounds, fz_scale(scale, scale)))) {
+    cols = (bbox.x1 - bbox.x0 + tile_size - 1) / tile_size;
+    rows = (bbox.y1 - bbox.y0 + tile_size - 1) / tile_size;
+}
+
+fz_irect TileGrid::tile(const int x, const int y) const {
+    fz_irect r;
+    r.x0 = bbox.x0 + x * tile_size;
+    r.y0 = bbox.y0 + y * tile_size;
+    r.x1 = std::min(r.x0 + tile_size, bbox.x1);
+    r.y1 = std::min(r.y0 + tile_size, bbox.y1);
+    return r;
+}
+
+int TileKey::zoom_key(const float scale) {
+    return static_cast<int>(std::lround(scale * 1000.0f));
+}
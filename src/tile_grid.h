@@ -0,0 +1,51 @@
+#ifndef PDFF_TILE_GRID_H
+#define PDFF_TILE_GRID_H
+#include <functional>
+#include <tuple>
+
+extern "C" {
+    #include <mupdf/fitz.h>
+}
+
+// How a page rendered at `scale` is cut into tile_size x tile_size tiles,
+// in device pixels. Edge tiles are smaller. Kept apart from TileCache so
+// the headless paths build without SDL.
+struct TileGrid {
+    static constexpr int tile_size = 512;
+
+    fz_irect bbox{};
+    int cols = 0;
+    int rows = 0;
+
+    TileGrid(const fz_rect &bounds, float scale);
+
+    fz_irect tile(int x, int y) const;
+};
+
+struct TileKey {
+    int page_num = 0;
+    int zoom = 0; // zoom_key of the render scale
+    int x = 0;
+    int y = 0;
+
+    static int zoom_key(float scale);
+
+    bool operator==(const TileKey &other) const {
+        return std::tie(page_num, zoom, x, y) == std::tie(other.page_num, other.zoom, other.x, other.y);
+    }
+    bool operator<(const TileKey &other) const {
+        return std::tie(page_num, zoom, x, y) < std::tie(other.page_num, other.zoom, other.x, other.y);
+    }
+};
+
+struct TileKeyHash {
+    size_t operator()(const TileKey &key) const {
+        size_t h = std::hash<int>()(key.page_num);
+        h = h * 31 + std::hash<int>()(key.zoom);
+        h = h * 31 + std::hash<int>()(key.x);
+        return h * 31 + std::hash<int>()(key.y);
+    }
+};
+
+
+#endif //PDFF_TILE_GRID_H